@@ -4,9 +4,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <atomic>
 
 namespace coServer{
 
+static std::atomic<uint64_t> s_fd_generation {0};
+
 FdCtx::FdCtx(int fd)
     : m_isInit(false)
     , m_isSocket(false)
@@ -15,7 +18,8 @@ FdCtx::FdCtx(int fd)
     , m_isClosed(false)
     , m_fd(fd)
     , m_recvTimeout(-1)
-    , m_sendTimeout(-1){
+    , m_sendTimeout(-1)
+    , m_generation(++s_fd_generation){
     init();
 }
 
@@ -38,7 +42,8 @@ bool FdCtx::init(){
     }
 
     if(m_isSocket){
-        int flags = fcntl(m_fd, F_GETFL, 0);
+        // 用原始的 fcntl：hook 的 F_GETFL 会查询 FdManager，而 init 在 FdManager 的写锁内执行
+        int flags = fcntl_f(m_fd, F_GETFL, 0);
         // 如果这个句柄是阻塞的， 就将之设置为非阻塞
         if(!(flags & O_NONBLOCK)){
             fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
@@ -33,6 +33,9 @@ public:
     void setTimeout(int type, uint64_t v);
 
     uint64_t getTimeout(int type);
+
+    // 创建顺序号，fd 关闭后复用时新的上下文代数不同
+    uint64_t getGeneration() const {return m_generation;}
 private:
     bool init();
 
@@ -45,6 +48,7 @@ private:
     int m_fd;
     uint64_t m_recvTimeout;
     uint64_t m_sendTimeout;
+    uint64_t m_generation;
 };
 
 
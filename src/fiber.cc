@@ -1,9 +1,13 @@
 #include <atomic>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
 
 #include "fiber.h"
 #include "config.h"
 #include "macro.h"
 #include "scheduler.h"
+#include "stack_allocator.h"
 
 namespace coServer{
 
@@ -19,20 +23,71 @@ static thread_local Fiber* t_fiber = nullptr;
 static thread_local Fiber::ptr t_threadFiber = nullptr;
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size = 
     Config::Lookup<uint32_t>("fiber.stack_size", 128*1024, "fiber stack size");
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack_size", 1024*1024, "fiber shared stack size");
+static ConfigVar<bool>::ptr g_fiber_stack_watermark =
+    Config::Lookup<bool>("fiber.stack_watermark", false, "fill fiber stacks with canary to measure usage");
+
+static std::atomic<bool> s_stack_watermark {false};
+
+struct _FiberIniter{
+    _FiberIniter(){
+        s_stack_watermark = g_fiber_stack_watermark->getValue();
+        g_fiber_stack_watermark->addListener([](const bool& old_value, const bool& new_value){
+            COSERVER_LOG_INFO(g_logger) << "fiber stack watermark changed from "
+                << old_value << " to " << new_value;
+            s_stack_watermark = new_value;
+        });
+    }
+};
+
+static _FiberIniter s_fiber_initer;
+
+// 协程局部变量
+static std::atomic<int> s_local_key_count {0};
+static Fiber::LocalDtor s_local_dtors[Fiber::MAX_LOCAL_KEYS] = {};
+
+// 栈水位标记值
+static const uint64_t s_stack_canary = 0xC0FFEE5AC0FFEE5AULL;
 
-// 内存配置器，在堆上给协程分配栈zhen
-class MallocStackAllocator{
-public:
-    static void* Alloc(size_t size){
-        return malloc(size);
+// 线程共享栈，绑定在该线程上的共享栈协程轮流在上面运行
+struct SharedStack{
+    char* stack = nullptr;
+    size_t size = 0;
+    // 当前栈上内容属于哪个协程
+    Fiber* owner = nullptr;
+    // 引用计数：所属线程和绑定在上面的协程各持有一个
+    std::atomic<size_t> refs = {1};
+
+    void unref(){
+        if(--refs == 0){
+            StackAllocator::Dealloc(stack, size);
+            delete this;
+        }
     }
+};
 
-    static void Dealloc(void* vp, size_t size){
-        return free(vp);
+// 线程退出时释放线程持有的共享栈引用，还有协程绑定时由最后一个协程释放
+struct SharedStackHolder{
+    ~SharedStackHolder(){
+        if(stack){
+            stack->unref();
+        }
     }
+    SharedStack* stack = nullptr;
 };
 
-using StackAllocator = MallocStackAllocator;
+static thread_local SharedStackHolder t_sharedStack;
+
+static SharedStack* GetSharedStack(){
+    if(!t_sharedStack.stack){
+        SharedStack* ss = new SharedStack;
+        ss->size = g_fiber_shared_stack_size->getValue();
+        ss->stack = (char*)StackAllocator::Alloc(ss->size);
+        t_sharedStack.stack = ss;
+    }
+    return t_sharedStack.stack;
+}
 
 // 主协程构造函数
 Fiber::Fiber(){
@@ -40,7 +95,7 @@ Fiber::Fiber(){
     // 把构造的新Fiber对象作为该线程的主协程
     SetThis(this);
 
-    if(getcontext(&m_ctx)){
+    if(!InitFiberContext(&m_ctx)){
         COSERVER_ASSERT2(false, "getcontext");
     }
     ++s_fiber_count;
@@ -48,30 +103,30 @@ Fiber::Fiber(){
 }
 
 // 暴露给用户的协程构造函数
-Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
+Fiber::Fiber(SmallCallable cb, size_t stacksize, bool use_caller, bool shared_stack)
     :m_id(++s_fiber_id)
-    ,m_cb(cb){
+    ,m_cb(std::move(cb))
+    ,m_entry(use_caller ? &Fiber::CallerMainFunc : &Fiber::MainFunc)
+    ,m_sharedStack(shared_stack){
 
     ++s_fiber_count;
-    m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
-
-    m_stack = StackAllocator::Alloc(m_stacksize);
-    if(getcontext(&m_ctx)){
-        COSERVER_ASSERT2(false, "getcontext");
-    }
-
-    // 协程上下文连接（用户可控的调用链）
-    m_ctx.uc_link = nullptr;
-    // 配置协程的调用栈
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-    // 设置协程上下文
-
-    if(!use_caller){
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    if(m_sharedStack){
+        // 共享栈在第一次切入时才绑定，上下文也在那时构造
+        m_needMake = true;
     }
     else{
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+        m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
+
+        m_stack = StackAllocator::Alloc(m_stacksize);
+        // 填充整个栈会提交全部物理页，只在测量时开启
+        if(s_stack_watermark){
+            fillStackCanary(m_stacksize);
+            m_watermark = true;
+        }
+        // 设置协程上下文
+        if(!MakeFiberContext(&m_ctx, m_stack, m_stacksize, m_entry)){
+            COSERVER_ASSERT2(false, "makecontext");
+        }
     }
     
     COSERVER_LOG_DEBUG(g_logger) << "Fiber::Fiber id=" << m_id;
@@ -79,9 +134,16 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
 
 Fiber::~Fiber(){
     --s_fiber_count;
-    if(m_stack){
+    clearLocals();
+    if(m_stack || m_sharedStack){
         COSERVER_ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEPT);
-        StackAllocator::Dealloc(m_stack, m_stacksize);
+        if(m_stack){
+            StackAllocator::Dealloc(m_stack, m_stacksize);
+        }
+        if(m_shared){
+            m_shared->unref();
+        }
+        free(m_saved);
     }
     else{
         // 当前析构的协程为主协程
@@ -93,57 +155,206 @@ Fiber::~Fiber(){
             SetThis(nullptr);
         }
     }
+    if(void* node = m_taskNode.load(std::memory_order_acquire)){
+        Scheduler::DeleteTaskNode(node);
+    }
     COSERVER_LOG_DEBUG(g_logger) << "Fiber::~Fiber id=" << m_id
                               << " total=" << s_fiber_count;
 }
 
 // 资源复用，将存储上下文的内存绑定到另一个协程上
-void Fiber::reset(std::function<void()> cb){
-    COSERVER_ASSERT(m_stack);
+void Fiber::reset(SmallCallable cb){
+    COSERVER_ASSERT(m_stack || m_sharedStack);
     COSERVER_ASSERT(m_state == TERM || m_state == INIT || m_state == EXCEPT);
     
-    m_cb = cb;
-    if(getcontext(&m_ctx)){
-        COSERVER_ASSERT2(false, "getcontext");
+    clearLocals();
+    m_cb = std::move(cb);
+    m_entry = &Fiber::MainFunc;
+    // 只需重新填充上次用到的部分
+    if(m_watermark){
+        fillStackCanary(getStackUsage());
     }
     // 清除栈帧
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    if(m_sharedStack){
+        m_needMake = true;
+    }
+    else if(!MakeFiberContext(&m_ctx, m_stack, m_stacksize, m_entry)){
+        COSERVER_ASSERT2(false, "makecontext");
+    }
     m_state = INIT;
 }
 
+int Fiber::CreateLocalKey(LocalDtor dtor){
+    int key = s_local_key_count++;
+    if(key >= (int)MAX_LOCAL_KEYS){
+        s_local_key_count = MAX_LOCAL_KEYS;
+        COSERVER_LOG_ERROR(g_logger) << "Fiber::CreateLocalKey no free key, max="
+            << MAX_LOCAL_KEYS;
+        return -1;
+    }
+    s_local_dtors[key] = dtor;
+    return key;
+}
+
+void Fiber::CheckLocalKey(int key){
+    COSERVER_ASSERT2(key >= 0 && key < s_local_key_count, "invalid fiber local key=" << key);
+}
+
+void* Fiber::GetLocal(int key){
+    CheckLocalKey(key);
+    return t_fiber ? t_fiber->m_locals[key] : nullptr;
+}
+
+void* Fiber::getLocal(int key) const{
+    CheckLocalKey(key);
+    return m_locals[key];
+}
+
+void Fiber::SetLocal(int key, void* value){
+    GetThisRaw()->setLocal(key, value);
+}
+
+void Fiber::setLocal(int key, void* value){
+    CheckLocalKey(key);
+    m_locals[key] = value;
+    m_hasLocals |= value != nullptr;
+}
+
+void Fiber::clearLocals(){
+    // 析构函数中可能再次设置局部变量，与 pthread 一样最多重复几轮
+    for(int round = 0; m_hasLocals && round < 4; ++round){
+        m_hasLocals = false;
+        int count = s_local_key_count;
+        for(int i = 0; i < count; ++i){
+            void* v = m_locals[i];
+            if(!v){
+                continue;
+            }
+            m_locals[i] = nullptr;
+            if(s_local_dtors[i]){
+                s_local_dtors[i](v);
+            }
+        }
+    }
+    m_hasLocals = false;
+}
+
+void Fiber::fillStackCanary(size_t size){
+    size_t words = std::min(size, (size_t)m_stacksize) / sizeof(uint64_t);
+    uint64_t* top = (uint64_t*)((char*)m_stack + m_stacksize);
+    std::fill(top - words, top, s_stack_canary);
+}
+
+size_t Fiber::getStackUsage() const{
+    if(!m_watermark){
+        return 0;
+    }
+    const uint64_t* begin = (const uint64_t*)m_stack;
+    const uint64_t* end = begin + m_stacksize / sizeof(uint64_t);
+    const uint64_t* p = begin;
+    while(p != end && *p == s_stack_canary){
+        ++p;
+    }
+    return (const char*)end - (const char*)p;
+}
+
+void Fiber::restoreSharedStack(){
+    if(!m_shared){
+        m_shared = GetSharedStack();
+        ++m_shared->refs;
+        m_stacksize = m_shared->size;
+        m_boundThread = GetThreadId();
+    }
+    COSERVER_ASSERT2(m_boundThread == GetThreadId(), "shared stack fiber_id=" << m_id
+        << " bound_thread=" << m_boundThread);
+
+    SharedStack* ss = m_shared;
+    if(ss->owner != this){
+        if(ss->owner){
+            ss->owner->saveSharedStack();
+        }
+        ss->owner = this;
+        if(!m_needMake && m_savedSize){
+            memcpy(ss->stack + ss->size - m_savedSize, m_saved, m_savedSize);
+        }
+    }
+    if(m_needMake){
+        if(!MakeFiberContext(&m_ctx, ss->stack, ss->size, m_entry)){
+            COSERVER_ASSERT2(false, "makecontext");
+        }
+        m_needMake = false;
+        m_savedSize = 0;
+    }
+}
+
+void Fiber::saveSharedStack(){
+    char* top = m_shared->stack + m_shared->size;
+    // 取切出时实际保存的栈顶，取不到时保存整个共享栈
+    char* sp = (char*)FiberContextSp(&m_ctx);
+    if(!sp || sp < m_shared->stack || sp > top){
+        sp = m_shared->stack;
+    }
+    size_t used = top - sp;
+    // 缓冲区按实际使用量分配，远大于需要时收缩
+    if(used > m_savedCap || used < m_savedCap / 2){
+        char* buf = (char*)realloc(m_saved, used);
+        COSERVER_ASSERT2(buf, "realloc saved stack size=" << used);
+        m_saved = buf;
+        m_savedCap = used;
+    }
+    memcpy(m_saved, sp, used);
+    m_savedSize = used;
+}
+
+// 共享栈协程执行结束，栈上内容不再需要保存
+static void ReleaseSharedStack(Fiber* fiber, SharedStack* ss){
+    if(ss && ss->owner == fiber){
+        ss->owner = nullptr;
+    }
+}
+
 void Fiber::call(){
     SetThis(this);
     m_state = EXEC;
-    if(swapcontext(&t_threadFiber->m_ctx, &m_ctx)){
+    if(m_sharedStack){
+        restoreSharedStack();
+    }
+    if(!SwapFiberContext(&t_threadFiber->m_ctx, &m_ctx)){
         COSERVER_ASSERT2(false, "swapcontext");
     }
 }
 
 void Fiber::back(){
     SetThis(t_threadFiber.get());
-    if(swapcontext(&m_ctx, &t_threadFiber->m_ctx)){
+    if(!SwapFiberContext(&m_ctx, &t_threadFiber->m_ctx)){
         COSERVER_ASSERT2(false, "swapcontext");
     }
 }
 
+// 切换的目标协程：调度线程上为调度协程，没有调度器时为线程主协程
+static Fiber* GetMainFiber(){
+    Fiber* main_fiber = Scheduler::GetMainFiber();
+    return main_fiber ? main_fiber : t_threadFiber.get();
+}
+
 void Fiber::swapIn(){
     SetThis(this);
     COSERVER_ASSERT(m_state != EXEC);
     m_state = EXEC;
+    if(m_sharedStack){
+        restoreSharedStack();
+    }
     // 将调度器主协程对象的栈帧切换到主协程上
-    if(swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)){
+    if(!SwapFiberContext(&GetMainFiber()->m_ctx, &m_ctx)){
         COSERVER_ASSERT2(false, "swapcontext");
     }
 }
 
 void Fiber::swapOut(){
-    SetThis(Scheduler::GetMainFiber());
+    Fiber* main_fiber = GetMainFiber();
+    SetThis(main_fiber);
     // 切换为调度器主协程对象的栈帧
-    if(swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)){
+    if(!SwapFiberContext(&m_ctx, &main_fiber->m_ctx)){
         COSERVER_ASSERT2(false, "swapcontext");
     }
 }
@@ -153,24 +364,28 @@ void Fiber::SetThis(Fiber* f){
 }
 
 Fiber::ptr Fiber::GetThis(){
-    if(t_fiber){
-        return t_fiber->shared_from_this();
+    return GetThisRaw()->shared_from_this();
+}
+
+Fiber* Fiber::GetThisRaw(){
+    if(COSERVER_LIKELY(t_fiber)){
+        return t_fiber;
     }
     Fiber::ptr main_fiber(new Fiber);
     COSERVER_ASSERT(t_fiber == main_fiber.get());
     t_threadFiber = main_fiber;
-    return t_fiber->shared_from_this();
+    return t_fiber;
 }
 
 void Fiber::YieldToReady(){
-    Fiber::ptr cur = GetThis();
+    Fiber* cur = GetThisRaw();
     COSERVER_ASSERT(cur->m_state == EXEC);
     cur->m_state = READY;
     cur->swapOut();
 }
 
 void Fiber::YieldToHold(){
-    Fiber::ptr cur = GetThis();
+    Fiber* cur = GetThisRaw();
     COSERVER_ASSERT(cur->m_state == EXEC);
     // cur->m_state = HOLD;
     cur->swapOut();
@@ -180,8 +395,13 @@ uint64_t Fiber::TotalFibers(){
     return s_fiber_count;
 }
 
+size_t Fiber::SharedStackBindings(){
+    // 线程自己持有一个引用
+    return t_sharedStack.stack ? t_sharedStack.stack->refs - 1 : 0;
+}
+
 void Fiber::MainFunc(){
-    Fiber::ptr cur = GetThis();
+    Fiber* cur = GetThisRaw();
     COSERVER_ASSERT(cur);
     try{
         cur->m_cb();
@@ -201,12 +421,11 @@ void Fiber::MainFunc(){
             << coServer::BacktraceToString();
     }
 
-    // 从智能指针中提取原始指针
-    auto raw_ptr = cur.get();
-    cur.reset();
-    // 使用原始指针切换协程
-    raw_ptr->swapOut();
-    COSERVER_ASSERT2(false, "never reach fiber_id=" + std::to_string(raw_ptr->getId()));
+    cur->clearLocals();
+    ReleaseSharedStack(cur, cur->m_shared);
+    // 协程栈上不持有自身的引用，调度器释放后协程对象即可析构
+    cur->swapOut();
+    COSERVER_ASSERT2(false, "never reach fiber_id=" + std::to_string(cur->getId()));
 }
 
 uint64_t Fiber::GetFiberId(){
@@ -217,7 +436,7 @@ uint64_t Fiber::GetFiberId(){
 }
 
 void Fiber::CallerMainFunc(){
-    Fiber::ptr cur = GetThis();
+    Fiber* cur = GetThisRaw();
     COSERVER_ASSERT(cur);
     try{
         cur->m_cb();
@@ -236,10 +455,10 @@ void Fiber::CallerMainFunc(){
             << std::endl
             << coServer::BacktraceToString();
     }
-    auto raw_ptr = cur.get();
-    cur.reset();
-    raw_ptr->back();
-    COSERVER_ASSERT2(false, "never reach fiber_id=" + std::to_string(raw_ptr->getId()));
+    cur->clearLocals();
+    ReleaseSharedStack(cur, cur->m_shared);
+    cur->back();
+    COSERVER_ASSERT2(false, "never reach fiber_id=" + std::to_string(cur->getId()));
 }
 
 }
\ No newline at end of file
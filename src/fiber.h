@@ -1,18 +1,28 @@
 #ifndef __FIBER_H__
 #define __FIBER_H__
 
+#include <atomic>
 #include <memory>
 #include <functional>
-#include <ucontext.h>
+
+#include "fiber_context.h"
+#include "noncopyable.h"
+#include "small_callable.h"
 
 namespace coServer{
 
 class Scheduler;
+struct SharedStack;
 
 class Fiber : public std::enable_shared_from_this<Fiber>{
 friend class Scheduler;
 public:
     typedef std::shared_ptr<Fiber> ptr;
+    // 协程局部变量析构函数
+    typedef void (*LocalDtor)(void*);
+
+    // 协程局部变量槽位数量
+    static const size_t MAX_LOCAL_KEYS = 16;
 
     enum State{
         INIT,
@@ -28,11 +38,19 @@ private:
     Fiber();
 
 public:
-    Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+    /**
+     * cb : 协程执行函数
+     * stacksize : 独立栈大小，0 表示使用 fiber.stack_size
+     * use_caller : 执行完成后是否返回到线程主协程（call/back）
+     * shared_stack : 是否运行在线程的共享栈上；切出后栈上内容按实际使用量拷贝到堆上，
+     *                适合大量长时间挂起的协程，第一次运行后绑定在该线程上
+    */
+    Fiber(SmallCallable cb, size_t stacksize = 0, bool use_caller = false
+        ,bool shared_stack = false);
     ~Fiber();
 
     // 重置协程函数，并重置状态
-    void reset(std::function<void()> cb);
+    void reset(SmallCallable cb);
 
     // 由非主协程调用，使线程执行对象协程封装的函数
     void swapIn();
@@ -50,21 +68,54 @@ public:
     // 返回协程对象的协程id
     uint64_t getId() const {return m_id;}
 
+    // 是否运行在共享栈上
+    bool isSharedStack() const {return m_sharedStack;}
+
+    // 共享栈协程绑定的线程id，没有绑定返回-1
+    int getBoundThread() const {return m_boundThread;}
+
+    // 共享栈协程切出后保存的栈大小
+    size_t getSavedStackSize() const {return m_savedSize;}
+
+    // 栈大小
+    uint32_t getStackSize() const {return m_stacksize;}
+
+    /**
+     *  栈使用的最高水位（字节）
+     *  需要开启 fiber.stack_watermark，创建时栈被填充标记值，从栈底向上找到第一个被改写的位置；
+     *  没有开启或者是共享栈协程时返回 0
+    */
+    size_t getStackUsage() const;
+
     // 返回当前正在执行的协程对象
     static Fiber::ptr GetThis();
 
+    /**
+     *  返回当前正在执行的协程对象的原始指针，不修改引用计数
+     *  协程运行期间调度器（或 call 的调用者）一直持有它的引用，在协程内部使用是安全的；
+     *  需要在协程切出后继续持有（例如交给定时器、事件回调）时用 GetThis
+    */
+    static Fiber* GetThisRaw();
+
     // 设置线程的主协程（0号协程）
     static void SetThis(Fiber* f);
 
     // 协程切换到后台，并设置为Ready状态
     static void YieldToReady();
 
-    // 协程写换到后台，并设置为Hold状态
+    /**
+     *  协程写换到后台，并设置为Hold状态
+     *  由调度器执行时，挂起期间调度器把引用交给协程自己持有（m_holdRef），再次执行时释放；
+     *  没有登记到事件、定时器等地方的协程不会被唤醒，也不会在 HOLD 状态析构
+    */
     static void YieldToHold();
 
     // 获取协程总数 
     static uint64_t TotalFibers();
 
+    // 绑定在当前线程共享栈上、还没有析构的协程数，线程退出前这些协程必须结束
+    static size_t SharedStackBindings();
+
     // 协程执行函数，执行完返回运行该协程的线程中的主协程（0号协程）
     static void MainFunc();
 
@@ -73,6 +124,37 @@ public:
 
     // 获取当前运行的协程id
     static uint64_t GetFiberId();
+
+    /**
+     *  注册协程局部变量，类似 pthread_key_create
+     *  dtor : 协程结束（TERM/EXCEPT）、reset 或析构时对非空的值调用
+     *  返回槽位下标，槽位用完返回 -1
+    */
+    static int CreateLocalKey(LocalDtor dtor = nullptr);
+
+    // 当前协程的局部变量
+    static void* GetLocal(int key);
+
+    static void SetLocal(int key, void* value);
+
+    void* getLocal(int key) const;
+
+    // 槽位下标不在已经注册的范围内（例如 CreateLocalKey 返回的 -1）时断言失败
+    static void CheckLocalKey(int key);
+
+    void setLocal(int key, void* value);
+private:
+    // 依次调用局部变量的析构函数并清空槽位
+    void clearLocals();
+
+    // 共享栈协程切入前，把它的栈内容恢复到线程共享栈上
+    void restoreSharedStack();
+
+    // 共享栈被其他协程占用前，保存当前占用者的栈内容
+    void saveSharedStack();
+
+    // 用标记值填充栈顶向下 size 字节
+    void fillStackCanary(size_t size);
 private:
     uint64_t m_id = 0;
     // 协程栈空间大小
@@ -80,11 +162,69 @@ private:
     // 协程状态
     State m_state = INIT;
     // 协程上下文（CPU信息，寄存器信息）
-    ucontext_t m_ctx;
+    FiberContext m_ctx;
     // 函数栈帧
     void* m_stack = nullptr;
     // 协程工作函数
-    std::function<void()> m_cb;
+    SmallCallable m_cb;
+    // 协程入口函数
+    void (*m_entry)() = nullptr;
+    // 是否使用共享栈
+    bool m_sharedStack = false;
+    // 共享栈上下文是否需要重新构造（首次运行或reset之后）
+    bool m_needMake = false;
+    // 绑定的线程id（共享栈协程）
+    int m_boundThread = -1;
+    // 绑定的共享栈
+    SharedStack* m_shared = nullptr;
+    // 切出时保存的栈内容
+    char* m_saved = nullptr;
+    size_t m_savedSize = 0;
+    size_t m_savedCap = 0;
+    // 栈是否填充了水位标记
+    bool m_watermark = false;
+    // 是否设置过局部变量
+    bool m_hasLocals = false;
+    // 调度器中挂起（HOLD）期间协程对自身的引用，恢复执行时释放
+    Fiber::ptr m_holdRef;
+    // 调度器唤醒该协程时复用的任务节点（Scheduler::FiberAndThread），析构时释放
+    std::atomic<void*> m_taskNode = {nullptr};
+    // 协程局部变量，随协程在线程间迁移
+    void* m_locals[MAX_LOCAL_KEYS] = {};
+};
+
+/**
+ *  协程局部变量，每个协程各自持有一个 T 对象，协程结束时 delete
+ *  一般定义为全局或静态变量，每个对象占用一个 Fiber::MAX_LOCAL_KEYS 中的槽位
+*/
+template<class T>
+class FiberLocal : Noncopyable{
+public:
+    FiberLocal()
+        :m_key(Fiber::CreateLocalKey(&FiberLocal::Destroy)){
+        // 槽位用完时返回 -1，之后的访问会越界
+        Fiber::CheckLocalKey(m_key);
+    }
+
+    // 当前协程的值，没有设置返回 nullptr
+    T* get() const {return (T*)Fiber::GetLocal(m_key);}
+
+    T* operator->() const {return get();}
+
+    T& operator*() const {return *get();}
+
+    // 替换当前协程的值，旧值被 delete
+    void reset(T* v = nullptr){
+        T* old = get();
+        Fiber::SetLocal(m_key, v);
+        delete old;
+    }
+private:
+    static void Destroy(void* v){
+        delete (T*)v;
+    }
+private:
+    int m_key;
 };
 
 }
@@ -0,0 +1,164 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "fiber_context.h"
+
+#ifdef COSERVER_FIBER_ASM_CONTEXT
+
+/**
+ *  void coserver_swap_context(void** from_sp, void* to_sp)
+ *  把 callee-saved 寄存器压到当前栈上，栈顶写入 *from_sp，
+ *  再切到 to_sp 指向的栈，弹出寄存器并 ret 到目标协程
+*/
+extern "C" void coserver_swap_context(void** from_sp, void* to_sp);
+
+#if defined(__x86_64__)
+asm(
+    ".pushsection .text\n"
+    ".globl coserver_swap_context\n"
+    ".type coserver_swap_context,@function\n"
+    ".align 16\n"
+    "coserver_swap_context:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size coserver_swap_context,.-coserver_swap_context\n"
+    ".popsection\n"
+);
+
+// 寄存器区：r15 r14 r13 r12 rbx rbp，之后是返回地址（entry）和伪造的 entry 返回地址 0
+static const size_t s_frame_words = 8;
+static const size_t s_entry_slot = 6;
+#elif defined(__aarch64__)
+asm(
+    ".pushsection .text\n"
+    ".globl coserver_swap_context\n"
+    ".type coserver_swap_context,%function\n"
+    ".align 4\n"
+    "coserver_swap_context:\n"
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+    ".size coserver_swap_context,.-coserver_swap_context\n"
+    ".popsection\n"
+);
+
+// 寄存器区：x19-x30 与 d8-d15，x30（lr）所在的槽位放 entry
+static const size_t s_frame_words = 20;
+static const size_t s_entry_slot = 11;
+#endif
+
+#endif
+
+namespace coServer{
+
+#ifdef COSERVER_FIBER_ASM_CONTEXT
+
+const char* FiberContextImpl(){
+    return "asm";
+}
+
+bool InitFiberContext(FiberContext* ctx){
+    // 主协程第一次被切出时才会写入栈顶
+    ctx->sp = nullptr;
+    return true;
+}
+
+bool MakeFiberContext(FiberContext* ctx, void* stack, size_t size, void (*entry)()){
+    if(!stack || size < s_frame_words * sizeof(void*) + 16){
+        return false;
+    }
+    // 栈顶按 16 字节对齐
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    void** frame = (void**)top - s_frame_words;
+    memset(frame, 0, s_frame_words * sizeof(void*));
+    frame[s_entry_slot] = (void*)entry;
+    ctx->sp = frame;
+    return true;
+}
+
+bool SwapFiberContext(FiberContext* from, FiberContext* to){
+    coserver_swap_context(&from->sp, to->sp);
+    return true;
+}
+
+void* FiberContextSp(const FiberContext* ctx){
+    return ctx->sp;
+}
+
+#else
+
+const char* FiberContextImpl(){
+    return "ucontext";
+}
+
+bool InitFiberContext(FiberContext* ctx){
+    return getcontext(&ctx->uc) == 0;
+}
+
+bool MakeFiberContext(FiberContext* ctx, void* stack, size_t size, void (*entry)()){
+    if(getcontext(&ctx->uc)){
+        return false;
+    }
+    // 协程上下文连接（用户可控的调用链）
+    ctx->uc.uc_link = nullptr;
+    // 配置协程的调用栈
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = size;
+    makecontext(&ctx->uc, entry, 0);
+    return true;
+}
+
+bool SwapFiberContext(FiberContext* from, FiberContext* to){
+    return swapcontext(&from->uc, &to->uc) == 0;
+}
+
+void* FiberContextSp(const FiberContext* ctx){
+    // swapcontext 把返回后的栈指针写入 uc_mcontext，返回地址单独保存，栈指针以上就是全部内容
+#if defined(__x86_64__)
+    return (void*)ctx->uc.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+    return (void*)ctx->uc.uc_mcontext.sp;
+#else
+    return nullptr;
+#endif
+}
+
+#endif
+
+}
@@ -0,0 +1,50 @@
+#ifndef __FIBER_CONTEXT_H__
+#define __FIBER_CONTEXT_H__
+
+/**
+ *  协程上下文切换
+ *  x86_64 / aarch64 下默认使用手写汇编，只保存 callee-saved 寄存器，不做 sigprocmask 系统调用；
+ *  编译时定义 COSERVER_FIBER_UCONTEXT（cmake -DCOSERVER_FIBER_UCONTEXT=ON）或在其他平台上退回 ucontext
+*/
+#include <stddef.h>
+
+#if !defined(COSERVER_FIBER_UCONTEXT) && (defined(__x86_64__) || defined(__aarch64__))
+#   define COSERVER_FIBER_ASM_CONTEXT 1
+#else
+#   include <ucontext.h>
+#endif
+
+namespace coServer{
+
+#ifdef COSERVER_FIBER_ASM_CONTEXT
+// 协程上下文：寄存器保存在协程自己的栈上，这里只记录栈顶指针
+struct FiberContext{
+    void* sp = nullptr;
+};
+#else
+struct FiberContext{
+    ucontext_t uc;
+};
+#endif
+
+// 当前使用的上下文切换实现名称（"asm" 或 "ucontext"）
+const char* FiberContextImpl();
+
+// 初始化当前执行流（主协程）的上下文
+bool InitFiberContext(FiberContext* ctx);
+
+// 在 stack 上构造一个从 entry 开始执行的上下文，entry 不允许返回
+bool MakeFiberContext(FiberContext* ctx, void* stack, size_t size, void (*entry)());
+
+// 保存当前上下文到 from，切换到 to 执行
+bool SwapFiberContext(FiberContext* from, FiberContext* to);
+
+/**
+ *  切出时保存的栈顶指针，共享栈协程按它保存栈上的内容
+ *  ucontext 在不支持的平台上返回 nullptr，调用者需要保存整个栈
+*/
+void* FiberContextSp(const FiberContext* ctx);
+
+}
+
+#endif
@@ -0,0 +1,110 @@
+#include <iomanip>
+
+#include "histogram.h"
+
+namespace coServer{
+
+Histogram::Histogram(){
+    reset();
+}
+
+size_t Histogram::BucketOf(uint64_t v){
+    return v ? 64 - __builtin_clzll(v) : 0;
+}
+
+uint64_t Histogram::BucketLow(size_t i){
+    return i ? 1ULL << (i - 1) : 0;
+}
+
+uint64_t Histogram::BucketHigh(size_t i){
+    return i < 64 ? 1ULL << i : UINT64_MAX;
+}
+
+void Histogram::record(uint64_t v){
+    m_buckets[BucketOf(v)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(v, std::memory_order_relaxed);
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while(v > max && !m_max.compare_exchange_weak(max, v, std::memory_order_relaxed));
+}
+
+void Histogram::recordLocal(uint64_t v){
+    std::atomic<uint64_t>& bucket = m_buckets[BucketOf(v)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_count.store(m_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_sum.store(m_sum.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    if(v > m_max.load(std::memory_order_relaxed)){
+        m_max.store(v, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::merge(const Histogram& other){
+    for(size_t i = 0; i < BUCKETS; ++i){
+        uint64_t n = other.m_buckets[i].load(std::memory_order_relaxed);
+        if(n){
+            m_buckets[i].fetch_add(n, std::memory_order_relaxed);
+        }
+    }
+    m_count.fetch_add(other.m_count.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    m_sum.fetch_add(other.m_sum.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    uint64_t v = other.m_max.load(std::memory_order_relaxed);
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while(v > max && !m_max.compare_exchange_weak(max, v, std::memory_order_relaxed));
+}
+
+void Histogram::reset(){
+    for(auto& i : m_buckets){
+        i = 0;
+    }
+    m_count = 0;
+    m_sum = 0;
+    m_max = 0;
+}
+
+uint64_t Histogram::percentile(double p) const{
+    uint64_t count = m_count;
+    if(!count){
+        return 0;
+    }
+    uint64_t target = (uint64_t)(count * p);
+    if(target >= count){
+        target = count - 1;
+    }
+    uint64_t seen = 0;
+    for(size_t i = 0; i < BUCKETS; ++i){
+        seen += m_buckets[i];
+        if(seen > target){
+            // 上界不超过实际最大值
+            uint64_t high = BucketHigh(i);
+            uint64_t max = m_max;
+            return high > max ? max : high;
+        }
+    }
+    return m_max;
+}
+
+std::ostream& Histogram::dump(std::ostream& os, const std::string& unit) const{
+    uint64_t count = m_count;
+    os << "count=" << count
+       << " avg=" << (count ? m_sum / count : 0) << unit
+       << " p50=" << percentile(0.5) << unit
+       << " p90=" << percentile(0.9) << unit
+       << " p99=" << percentile(0.99) << unit
+       << " max=" << m_max << unit << std::endl;
+    if(!count){
+        return os;
+    }
+    for(size_t i = 0; i < BUCKETS; ++i){
+        uint64_t n = m_buckets[i];
+        if(!n){
+            continue;
+        }
+        os << "    [" << BucketLow(i) << ", " << BucketHigh(i) << ")" << unit
+           << " " << n
+           << " " << std::fixed << std::setprecision(2) << n * 100.0 / count << "%"
+           << std::defaultfloat << std::endl;
+    }
+    return os;
+}
+
+}
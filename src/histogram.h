@@ -0,0 +1,65 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <iostream>
+#include <string>
+
+#include "noncopyable.h"
+
+namespace coServer{
+
+/**
+ *  按 2 的幂分桶的直方图，多线程并发记录
+ *  第 i 个桶统计 [2^(i-1), 2^i) 区间内的值，第 0 个桶统计 0
+*/
+class Histogram : Noncopyable{
+public:
+    static const size_t BUCKETS = 65;
+
+    Histogram();
+
+    // 记录一个值
+    void record(uint64_t v);
+
+    // 只有一个线程写入时使用，不需要原子加，读取的线程看到的是近似值
+    void recordLocal(uint64_t v);
+
+    // 把 other 的统计加到当前直方图
+    void merge(const Histogram& other);
+
+    // 清空统计
+    void reset();
+
+    uint64_t getCount() const {return m_count;}
+
+    uint64_t getSum() const {return m_sum;}
+
+    uint64_t getMax() const {return m_max;}
+
+    // 第 i 个桶的计数
+    uint64_t getBucket(size_t i) const {return m_buckets[i];}
+
+    // 百分位数（p 取 0~1），返回所在桶的上界
+    uint64_t percentile(double p) const;
+
+    // 输出汇总与非空的桶，unit 为数值单位
+    std::ostream& dump(std::ostream& os, const std::string& unit = "") const;
+
+    // 值所在的桶
+    static size_t BucketOf(uint64_t v);
+
+    // 桶的下界和上界（不含）
+    static uint64_t BucketLow(size_t i);
+    static uint64_t BucketHigh(size_t i);
+private:
+    std::atomic<uint64_t> m_buckets[BUCKETS];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_max;
+};
+
+}
+
+#endif
@@ -7,6 +7,7 @@
 #include "iomanager.h"
 #include "fd_manager.h"
 #include "macro.h"
+#include "uring.h"
 
 coServer::Logger::ptr g_logger = COSERVER_LOG_NAME("system");
 
@@ -79,15 +80,35 @@ void set_hook_enable(bool flag){
     t_hook_enable = flag;
 }
 
+// 记录一次系统调用到当前调度器的统计
+static inline void record_syscall(){
+    Scheduler* sc = Scheduler::GetThis();
+    if(sc){
+        sc->recordSyscall();
+    }
+}
+
+// 使用 io_uring 直接提交操作；共享栈协程切出后栈地址失效，缓冲区可能在栈上，仍然等待就绪
+static inline bool use_uring(IOManager* iom){
+    if(!iom || !iom->isUring()){
+        return false;
+    }
+    Fiber* fiber = Fiber::GetThisRaw();
+    return !fiber || !fiber->isSharedStack();
+}
+
 }
 
 struct timer_info{
     int cancelled = 0;
 };
 
+/**
+ *  req : io_uring 后端直接提交的操作，op 为 NONE 时不支持，等待就绪后调用 fun
+*/
 template<typename OriginFun, typename... Args>
 static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
-        uint32_t event, int timeout_so, Args&&... args) {
+        uint32_t event, int timeout_so, const coServer::IoRequest& req, Args&&... args) {
     if(!coServer::t_hook_enable) {
         return fun(fd, std::forward<Args>(args)...);
     }
@@ -110,16 +131,34 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
     }
 
     uint64_t to = ctx->getTimeout(timeout_so);
+    coServer::IOManager* iom = coServer::IOManager::GetThis();
+    if(req.op != coServer::IoRequest::NONE && coServer::use_uring(iom)) {
+        // 一次提交完成操作，不用先调用、等待就绪、再调用
+        ssize_t n = iom->submitIo(req, to);
+        if(n >= 0) {
+            return n;
+        }
+        if(n != -EAGAIN) {
+            // 被 close 取消的操作与就绪等待一样返回 EBADF
+            errno = (n == -ECANCELED && ctx->isClose()) ? EBADF : -n;
+            return -1;
+        }
+    }
     std::shared_ptr<timer_info> tinfo(new timer_info);
 
 retry:
+    coServer::record_syscall();
     ssize_t n = fun(fd, std::forward<Args>(args)...);
     while(n == -1 && errno == EINTR) {
+        coServer::record_syscall();
         n = fun(fd, std::forward<Args>(args)...);
     }
     // 处于阻塞状态
     if(n == -1 && errno == EAGAIN) {
-        coServer::IOManager* iom = coServer::IOManager::GetThis();
+        if(iom->consumeReady(fd, (coServer::IOManager::Event)(event))) {
+            // 常驻注册模式下上次等待之后已经就绪，直接重试，不用挂起
+            goto retry;
+        }
         coServer::Timer::ptr timer;
         std::weak_ptr<timer_info> winfo(tinfo);
 
@@ -137,11 +176,16 @@ retry:
         // 添加任务
         int rt = iom->addEvent(fd, (coServer::IOManager::Event)(event));
         if(rt) {
-            COSERVER_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
-                << fd << ", " << event << ")";
+            // drain 超过截止时间后 addEvent 返回 ECANCELED，被取消唤醒的协程重试时也在这里返回
+            int err = errno;
+            if(err != ECANCELED) {
+                COSERVER_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
+                    << fd << ", " << event << ")";
+            }
             if(timer) {
                 timer->cancel();
             }
+            errno = err;
             return -1;
         } else {
             coServer::Fiber::YieldToHold();
@@ -172,9 +216,9 @@ unsigned int sleep(unsigned int seconds){
     }
     coServer::Fiber::ptr fiber = coServer::Fiber::GetThis();
     coServer::IOManager* iom = coServer::IOManager::GetThis();
-    iom->addTimer(seconds * 1000, std::bind((void(coServer::Scheduler::*)
-            (coServer::Fiber::ptr, int thread))&coServer::IOManager::schedule
-            ,iom, fiber, -1));
+    iom->addTimer(seconds * 1000, [iom, fiber](){
+        iom->schedule(fiber);
+    });
     coServer::Fiber::YieldToHold();
     return 0;
 }
@@ -185,9 +229,9 @@ int usleep(useconds_t usec) {
     }
     coServer::Fiber::ptr fiber = coServer::Fiber::GetThis();
     coServer::IOManager* iom = coServer::IOManager::GetThis();
-    iom->addTimer(usec / 1000, std::bind((void(coServer::Scheduler::*)
-            (coServer::Fiber::ptr, int thread))&coServer::IOManager::schedule
-            ,iom, fiber, -1));
+    iom->addTimer(usec / 1000, [iom, fiber](){
+        iom->schedule(fiber);
+    });
     coServer::Fiber::YieldToHold();
     return 0;
 }
@@ -202,9 +246,9 @@ int nanosleep(const struct timespec *req, struct timespec *rem) {
     coServer::Fiber::ptr fiber = coServer::Fiber::GetThis();
     coServer::IOManager* iom = coServer::IOManager::GetThis();
     // 添加一个定时器时间到IOManager中
-    iom->addTimer(timeout_ms
-        , std::bind((void(coServer::Scheduler::*)(coServer::Fiber::ptr, int thread))&coServer::IOManager::schedule
-        ,iom, fiber, -1));
+    iom->addTimer(timeout_ms, [iom, fiber](){
+        iom->schedule(fiber);
+    });
     // 将当前协程挂起
     coServer::Fiber::YieldToHold();
     return 0;
@@ -240,6 +284,16 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return connect_f(fd, addr, addrlen);
     }
 
+    coServer::IOManager* iom = coServer::IOManager::GetThis();
+    if(coServer::use_uring(iom)) {
+        int rt = iom->submitIo(coServer::IoRequest::Connect(fd, addr, addrlen), timeout_ms);
+        if(rt < 0) {
+            errno = -rt;
+            return -1;
+        }
+        return 0;
+    }
+
     int n = connect_f(fd, addr, addrlen);
     if(n == 0) {
         return 0;
@@ -247,7 +301,6 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return n;
     }
 
-    coServer::IOManager* iom = coServer::IOManager::GetThis();
     coServer::Timer::ptr timer;
     std::shared_ptr<timer_info> tinfo(new timer_info);
     std::weak_ptr<timer_info> winfo(tinfo);
@@ -273,10 +326,20 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
             errno = tinfo->cancelled;
             return -1;
         }
+        if(iom->isDrainExpired()) {
+            // 被 drain 取消唤醒，连接可能还没有完成
+            errno = ECANCELED;
+            return -1;
+        }
     } else {
+        int err = errno;
         if(timer) {
             timer->cancel();
         }
+        if(err == ECANCELED) {
+            errno = err;
+            return -1;
+        }
         COSERVER_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
     }
 
@@ -299,7 +362,8 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 
 int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
     // 句柄， 方法， 方法名， IO事件， 超时时间， 参数
-    int fd = do_io(s, accept_f, "accept", coServer::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    int fd = do_io(s, accept_f, "accept", coServer::IOManager::READ, SO_RCVTIMEO
+            ,coServer::IoRequest::Accept(s, addr, addrlen), addr, addrlen);
     if(fd >= 0) {
         coServer::FdMgr::GetInstance()->get(fd, true);
     }
@@ -307,47 +371,63 @@ int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
-    return do_io(fd, read_f, "read", coServer::IOManager::READ, SO_RCVTIMEO, buf, count);
+    return do_io(fd, read_f, "read", coServer::IOManager::READ, SO_RCVTIMEO
+            ,coServer::IoRequest::Recv(fd, buf, count), buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, readv_f, "readv", coServer::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+    return do_io(fd, readv_f, "readv", coServer::IOManager::READ, SO_RCVTIMEO
+            ,coServer::IoRequest::Readv(fd, iov, iovcnt), iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
-    return do_io(sockfd, recv_f, "recv", coServer::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+    return do_io(sockfd, recv_f, "recv", coServer::IOManager::READ, SO_RCVTIMEO
+            ,coServer::IoRequest::Recv(sockfd, buf, len, flags), buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen) {
-    return do_io(sockfd, recvfrom_f, "recvfrom", coServer::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+    return do_io(sockfd, recvfrom_f, "recvfrom", coServer::IOManager::READ, SO_RCVTIMEO
+            ,src_addr ? coServer::IoRequest() : coServer::IoRequest::Recv(sockfd, buf, len, flags)
+            ,buf, len, flags, src_addr, addrlen);
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
-    return do_io(sockfd, recvmsg_f, "recvmsg", coServer::IOManager::READ, SO_RCVTIMEO, msg, flags);
+    return do_io(sockfd, recvmsg_f, "recvmsg", coServer::IOManager::READ, SO_RCVTIMEO
+            ,coServer::IoRequest::RecvMsg(sockfd, msg, flags), msg, flags);
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
-    return do_io(fd, write_f, "write", coServer::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+    return do_io(fd, write_f, "write", coServer::IOManager::WRITE, SO_SNDTIMEO
+            ,coServer::IoRequest::Send(fd, buf, count), buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, writev_f, "writev", coServer::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+    return do_io(fd, writev_f, "writev", coServer::IOManager::WRITE, SO_SNDTIMEO
+            ,coServer::IoRequest::Writev(fd, iov, iovcnt), iov, iovcnt);
 }
 
 ssize_t send(int s, const void *msg, size_t len, int flags) {
-    return do_io(s, send_f, "send", coServer::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+    return do_io(s, send_f, "send", coServer::IOManager::WRITE, SO_SNDTIMEO
+            ,coServer::IoRequest::Send(s, msg, len, flags), msg, len, flags);
 }
 
 ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct sockaddr *to, socklen_t tolen) {
-    return do_io(s, sendto_f, "sendto", coServer::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags, to, tolen);
+    return do_io(s, sendto_f, "sendto", coServer::IOManager::WRITE, SO_SNDTIMEO
+            ,to ? coServer::IoRequest() : coServer::IoRequest::Send(s, msg, len, flags)
+            ,msg, len, flags, to, tolen);
 }
 
 ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
-    return do_io(s, sendmsg_f, "sendmsg", coServer::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+    return do_io(s, sendmsg_f, "sendmsg", coServer::IOManager::WRITE, SO_SNDTIMEO
+            ,coServer::IoRequest::SendMsg(s, msg, flags), msg, flags);
 }
 
 int close(int fd) {
     if(!coServer::t_hook_enable) {
+        // 不取消事件，但句柄上下文要删除，fd 复用后 IOManager 根据代数重新注册
+        if(coServer::FdMgr::GetInstance()->get(fd)) {
+            coServer::FdMgr::GetInstance()->del(fd);
+        }
         return close_f(fd);
     }
 
@@ -1,17 +1,67 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <algorithm>
 #include <sys/epoll.h>
 #include <string.h>
 #include <unistd.h>
+#include <linux/io_uring.h>
 
 #include "iomanager.h"
+#include "config.h"
+#include "fd_manager.h"
 #include "macro.h"
 #include "log.h"
+#include "uring.h"
 
 namespace coServer{
 
 static coServer::Logger::ptr g_logger = COSERVER_LOG_NAME("system");
 
+static ConfigVar<std::string>::ptr g_iomanager_backend =
+    Config::Lookup<std::string>("iomanager.backend", "epoll"
+            ,"iomanager io backend: epoll or io_uring (falls back to epoll when unavailable)");
+
+static ConfigVar<bool>::ptr g_iomanager_epoll_persistent =
+    Config::Lookup<bool>("iomanager.epoll_persistent", false
+            ,"register each fd once for EPOLLIN|EPOLLOUT|EPOLLET and keep it until close");
+
+static ConfigVar<uint32_t>::ptr g_iomanager_uring_entries =
+    Config::Lookup<uint32_t>("iomanager.uring_entries", 1024, "io_uring submission queue entries");
+
+/**
+ *  io_uring 完成事件 user_data 的低 3 位表示类型，高位是对象地址（至少 8 字节对齐）
+ *  URING_OP     : UringOp*，submitIo 提交的操作
+ *  URING_READ   : FdContext*，addEvent 的读事件 poll
+ *  URING_WRITE  : FdContext*，addEvent 的写事件 poll
+ *  URING_CANCEL : 取消请求，高位为空或发起超时取消的 UringOp*
+ *  URING_WAKE   : 唤醒管道的 poll
+*/
+enum UringTag{
+    URING_OP = 0,
+    URING_READ = 1,
+    URING_WRITE = 2,
+    URING_CANCEL = 3,
+    URING_WAKE = 4,
+    URING_TAG_MASK = 7
+};
+
+// submitIo 提交的一个操作，内核持有期间通过 kernelRef 保持存活
+struct IOManager::UringOp{
+    typedef std::shared_ptr<UringOp> ptr;
+    Fiber::ptr fiber;
+    FdContext* fdCtx = nullptr;
+    int32_t res = 0;
+    // 提交者挂起前与完成处理各自 exchange 一次，后到的一方负责唤醒 / 不挂起
+    std::atomic<bool> arrived = {false};
+    std::atomic<bool> timedOut = {false};
+    // 完成时释放
+    ptr kernelRef;
+    // 超时取消请求完成时释放，期间地址不会被新的操作复用
+    ptr cancelRef;
+};
+
 enum EpollCtlOp{};
 
 static std::ostream& operator<< (std::ostream& os, const EpollCtlOp& op){
@@ -76,6 +126,13 @@ void IOManager::FdContext::resetContext(EventContext& ctx){
     ctx.cb = nullptr;
 }
 
+void IOManager::FdContext::checkGeneration(uint64_t gen){
+    if(registered && generation != gen){
+        registered = false;
+        ready = NONE;
+    }
+}
+
 void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     COSERVER_LOG_INFO(g_logger) << "fd=" << fd
        << " triggerEvent event=" << event
@@ -95,28 +152,45 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     return;
 }
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
-    :Scheduler(threads, use_caller, name){
-    // 创建epoll对象， 最多监听5000个文件描述符
-    m_epfd = epoll_create(5000);
-    COSERVER_ASSERT(m_epfd > 0);
+IOManager::IOManager(size_t threads, bool use_caller, const std::string& name
+        ,const std::vector<int>& cpus, Backend backend)
+    :Scheduler(threads, use_caller, name, cpus){
+    if(backend == BACKEND_CONFIG){
+        backend = g_iomanager_backend->getValue() == "io_uring" ? BACKEND_IO_URING : BACKEND_EPOLL;
+    }
+    if(backend == BACKEND_IO_URING){
+        m_uring.reset(IoUring::Create(g_iomanager_uring_entries->getValue()));
+        if(!m_uring){
+            COSERVER_LOG_WARN(g_logger) << getName() << " io_uring unavailable, fall back to epoll";
+        }
+    }
 
     // 创建两个管道
     int rt = pipe(m_tickleFds);
     COSERVER_ASSERT(!rt);
 
-    epoll_event event;
-    memset(&event, 0, sizeof(epoll_event));
-    event.events = EPOLLIN | EPOLLET;
-    // 当 管道[0] 上发生关注的事件（写事件）时，将通知epoll对象
-    event.data.fd = m_tickleFds[0];
-
     // 设置管道属性，将文件描述符设置为非阻塞IO
     rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
     COSERVER_ASSERT(!rt);
 
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    COSERVER_ASSERT(!rt);
+    if(m_uring){
+        armUringWake();
+    }
+    else{
+        m_persistent = g_iomanager_epoll_persistent->getValue();
+        // 创建epoll对象， 最多监听5000个文件描述符
+        m_epfd = epoll_create(5000);
+        COSERVER_ASSERT(m_epfd > 0);
+
+        epoll_event event;
+        memset(&event, 0, sizeof(epoll_event));
+        event.events = EPOLLIN | EPOLLET;
+        // 当 管道[0] 上发生关注的事件（写事件）时，将通知epoll对象
+        event.data.fd = m_tickleFds[0];
+
+        rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
+        COSERVER_ASSERT(!rt);
+    }
     contextResize(32);
 
     start();
@@ -124,7 +198,10 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
 
 IOManager::~IOManager(){
     stop();
-    close(m_epfd);
+    if(m_epfd >= 0){
+        close(m_epfd);
+    }
+    m_uring.reset();
     close(m_tickleFds[0]);
     close(m_tickleFds[1]);
 
@@ -137,30 +214,47 @@ IOManager::~IOManager(){
 
 void IOManager::contextResize(size_t size){
     m_fdContexts.resize(size);
-    for(size_t i=0; i<m_fdContexts.size(); ++i){
-        if(!m_fdContexts[i]){
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
-        }
+}
+
+IOManager::FdContext* IOManager::createContext(int fd){
+    if((int)m_fdContexts.size() <= fd){
+        contextResize(std::max((size_t)(fd * 1.5), (size_t)fd + 1));
+    }
+    if(!m_fdContexts[fd]){
+        m_fdContexts[fd] = new FdContext;
+        m_fdContexts[fd]->fd = fd;
     }
+    return m_fdContexts[fd];
 }
 
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb){
-    FdContext* fd_ctx = nullptr;
+IOManager::FdContext* IOManager::getContext(int fd){
     RWMutexType::ReadLock lock(m_mutex);
     // 文件描述符的 fd 是多少，对应在 m_fdContexts 的下标就是多少
-    if((int)m_fdContexts.size() > fd){
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    }
-    else{
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
+    if((int)m_fdContexts.size() > fd && m_fdContexts[fd]){
+        return m_fdContexts[fd];
     }
+    lock.unlock();
+    RWMutexType::WriteLock lock2(m_mutex);
+    return createContext(fd);
+}
+
+// 句柄上下文的代数，不由 FdManager 管理的句柄为 0
+static uint64_t GetFdGeneration(int fd){
+    FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd);
+    return ctx ? ctx->getGeneration() : 0;
+}
+
+int IOManager::addEvent(int fd, Event event, SmallCallable cb){
+    FdContext* fd_ctx = getContext(fd);
+    // 关闭句柄的线程不一定经过这个 IOManager 的 cancelAll，按代数判断注册是否还有效
+    uint64_t gen = m_persistent ? GetFdGeneration(fd) : 0;
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    if(COSERVER_UNLIKELY(isDrainExpired())){
+        // 在句柄锁内检查，与 onDrainDeadline 中的 cancelAll 不会错过
+        errno = ECANCELED;
+        return -1;
+    }
     if(COSERVER_UNLIKELY(fd_ctx->events & event)){
         COSERVER_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd
             << " event=" << (EPOLL_EVENTS)event
@@ -169,19 +263,55 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb){
     // 判断是否添加了重复的事件（避免不同线程操作同一句柄）
     COSERVER_ASSERT(!(fd_ctx->events & event));
 
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
-
-    // 添加一个新事件到文件描述符中
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt){
-        COSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
-            << (EPOLL_EVENTS)fd_ctx->events;
-        return -1;
+    if(m_uring){
+        // 每个事件一个单次 poll，触发后由 onUringCompletion 唤醒
+        uint64_t user_data = (uint64_t)(uintptr_t)fd_ctx | (event == READ ? URING_READ : URING_WRITE);
+        recordSyscall();
+        if(!m_uring->submitPoll(fd, event == READ ? POLLIN : POLLOUT, user_data)){
+            if(!UringBusy()){
+                return -1;
+            }
+            // 完成事件的处理会加句柄锁，放开锁收割后重试
+            lock2.unlock();
+            backoffUring();
+            return addEvent(fd, event, std::move(cb));
+        }
+    }
+    else if(m_persistent){
+        fd_ctx->checkGeneration(gen);
+        if(!fd_ctx->registered){
+            epoll_event epevent;
+            epevent.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            epevent.data.ptr = fd_ctx;
+            recordSyscall();
+            int rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, fd, &epevent);
+            // EEXIST：上下文换了但句柄没有关闭，原来的注册仍然有效
+            if(rt && errno != EEXIST){
+                COSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                    << (EpollCtlOp)EPOLL_CTL_ADD << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                    << rt << " (" << errno << ") (" << strerror(errno) << ")";
+                return -1;
+            }
+            fd_ctx->registered = true;
+            fd_ctx->generation = gen;
+        }
+    }
+    else{
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        epoll_event epevent;
+        epevent.events = EPOLLET | fd_ctx->events | event;
+        epevent.data.ptr = fd_ctx;
+
+        // 添加一个新事件到文件描述符中
+        recordSyscall();
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if(rt){
+            COSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
+                << (EPOLL_EVENTS)fd_ctx->events;
+            return -1;
+        }
     }
     // 待执行事件数量＋1
     ++m_pendingEventCount;
@@ -194,13 +324,19 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb){
         
     event_ctx.scheduler = Scheduler::GetThis();
     if(cb){
-        event_ctx.cb.swap(cb);
+        event_ctx.cb = std::move(cb);
     }
     else{
         event_ctx.fiber = Fiber::GetThis();
         COSERVER_ASSERT2(event_ctx.fiber->getState() == Fiber::EXEC
             ,"state=" << event_ctx.fiber->getState());
     }
+    if(m_persistent && (fd_ctx->ready & event)){
+        // 等待之前已经就绪，边沿触发不会再通知，直接触发
+        fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+        fd_ctx->triggerEvent(event);
+        --m_pendingEventCount;
+    }
     return 0;
 }
 
@@ -211,24 +347,36 @@ bool IOManager::delEvent(int fd, Event event){
     }
     FdContext* fd_ctx = m_fdContexts[fd];
     lock.unlock();
+    if(!fd_ctx){
+        return false;
+    }
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if(COSERVER_UNLIKELY(!(fd_ctx->events & event))){
         return false;
     }
 
-    Event new_events = (Event)(fd_ctx->events & event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        COSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-            return false;
+    Event new_events = (Event)(fd_ctx->events & ~event);
+    if(m_uring){
+        // poll 可能已经完成，完成事件在 onUringCompletion 中发现事件已经删除后忽略
+        uint64_t target = (uint64_t)(uintptr_t)fd_ctx | (event == READ ? URING_READ : URING_WRITE);
+        recordSyscall();
+        m_uring->submitPollRemove(target, URING_CANCEL);
+    }
+    else if(!m_persistent){
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        recordSyscall();
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if(rt) {
+            COSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+                return false;
+        }
     }
 
     --m_pendingEventCount;
@@ -246,24 +394,35 @@ bool IOManager::cancelEvent(int fd, Event event){
     }
     FdContext* fd_ctx = m_fdContexts[fd];
     lock.unlock();
+    if(!fd_ctx){
+        return false;
+    }
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
     if(COSERVER_UNLIKELY(!(fd_ctx->events & event))){
         return false;
     }
 
-    Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt){
-        COSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-            return false; 
+    if(m_uring){
+        uint64_t target = (uint64_t)(uintptr_t)fd_ctx | (event == READ ? URING_READ : URING_WRITE);
+        recordSyscall();
+        m_uring->submitPollRemove(target, URING_CANCEL);
+    }
+    else if(!m_persistent){
+        Event new_events = (Event)(fd_ctx->events & ~event);
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        recordSyscall();
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if(rt){
+            COSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+                return false; 
+        }
     }
 
     fd_ctx->triggerEvent(event);
@@ -278,23 +437,56 @@ bool IOManager::cancelAll(int fd){
     }
     FdContext* fd_ctx = m_fdContexts[fd];
     lock.unlock();
-
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    if(!fd_ctx->events) {
+    if(!fd_ctx){
         return false;
     }
 
-    int op = EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = 0;
-    epevent.data.ptr = fd_ctx;
+    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    if(m_uring){
+        if(!fd_ctx->events && !fd_ctx->uringOps) {
+            return false;
+        }
+        // 取消 fd 上的 poll 与正在进行的操作，操作以 -ECANCELED 完成
+        recordSyscall();
+        if(!m_uring->submitCancelFd(fd, URING_CANCEL) && UringBusy()) {
+            // 没有取消时关闭后正在进行的操作永远不会完成，收割后重试
+            lock2.unlock();
+            backoffUring();
+            return cancelAll(fd);
+        }
+    }
+    else if(m_persistent){
+        if(fd_ctx->registered) {
+            // 删除常驻注册，fd 复用后重新注册
+            epoll_event epevent;
+            memset(&epevent, 0, sizeof(epevent));
+            recordSyscall();
+            epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, &epevent);
+            fd_ctx->registered = false;
+            fd_ctx->ready = NONE;
+        }
+        if(!fd_ctx->events) {
+            return false;
+        }
+    }
+    else{
+        if(!fd_ctx->events) {
+            return false;
+        }
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        COSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+        int op = EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = 0;
+        epevent.data.ptr = fd_ctx;
+
+        recordSyscall();
+        int rt = epoll_ctl(m_epfd, op, fd, &epevent);
+        if(rt) {
+            COSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
     if(fd_ctx->events & READ) {
@@ -310,6 +502,30 @@ bool IOManager::cancelAll(int fd){
     return true;
 }
 
+bool IOManager::consumeReady(int fd, Event event){
+    if(!m_persistent){
+        return false;
+    }
+    uint64_t gen = GetFdGeneration(fd);
+    RWMutexType::ReadLock lock(m_mutex);
+    if((int)m_fdContexts.size() <= fd){
+        return false;
+    }
+    FdContext* fd_ctx = m_fdContexts[fd];
+    lock.unlock();
+    if(!fd_ctx){
+        return false;
+    }
+
+    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    fd_ctx->checkGeneration(gen);
+    if(!(fd_ctx->ready & event)){
+        return false;
+    }
+    fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+    return true;
+}
+
 IOManager* IOManager::GetThis(){
     return dynamic_cast<IOManager*>(Scheduler::GetThis());
 }
@@ -318,12 +534,38 @@ void IOManager::tickle(){
     if(!hasIdleThreads()){
         return;
     }
+    recordTickle();
+    if(wakeOne()){
+        return;
+    }
+    wakePoller();
+}
+
+void IOManager::tickleWorker(Worker* worker){
+    recordTickle();
+    if(wakeWorker(worker)){
+        return;
+    }
+    if(m_pollerWorker == worker){
+        wakePoller();
+    }
+}
+
+bool IOManager::wakePoller(){
+    if(!m_pollerBlocked.exchange(false)){
+        return false;
+    }
+    recordSyscall();
     int rt = write(m_tickleFds[1], "T", 1);
     COSERVER_ASSERT(rt == 1);
+    return true;
 }
 
 bool IOManager::stopping(uint64_t& timeout){
-    return m_pendingEventCount == 0 && Scheduler::stopping();
+    timeout = getNextTimer();
+    return timeout == ~0ull
+        && m_pendingEventCount == 0
+        && Scheduler::stopping();
 }
 
 bool IOManager::stopping() {
@@ -331,9 +573,29 @@ bool IOManager::stopping() {
     return stopping(timeout);
 }
 
+void IOManager::onDrainDeadline(DrainResult& result){
+    Scheduler::onDrainDeadline(result);
+    result.cancelledEvents = m_pendingEventCount;
+    size_t size = 0;
+    {
+        RWMutexType::ReadLock lock(m_mutex);
+        size = m_fdContexts.size();
+    }
+    // isDrainExpired 已经为 true，之后新增的事件都会被拒绝，这里只需要处理已经注册的
+    for(size_t i = 0; i < size; ++i){
+        if(cancelAll(i)){
+            ++result.cancelledFds;
+        }
+    }
+    result.timers = getTimerCount();
+    COSERVER_LOG_WARN(g_logger) << getName() << " drain cancelled events=" << result.cancelledEvents
+        << " fds=" << result.cancelledFds << " timers=" << result.timers;
+}
+
 void IOManager::idle(){
     COSERVER_LOG_DEBUG(g_logger) << "idle";
     const uint64_t MAX_EVNETS = 256;
+    static const int MAX_TIMEOUT = 3000;
     epoll_event* events = new epoll_event[MAX_EVNETS]();
     std::shared_ptr<epoll_event> shared_events(events, [](epoll_event* ptr){
         delete[] ptr;
@@ -341,29 +603,52 @@ void IOManager::idle(){
 
     while(true) {
         uint64_t next_timeout = 0;
-        // if(COSERVER_UNLIKELY(stopping(next_timeout))) {
-        //     COSERVER_LOG_INFO(g_logger) << "name=" << getName()
-        //                              << " idle stopping exit";
-        //     break;
-        // }
+        if(COSERVER_UNLIKELY(stopping(next_timeout))) {
+            COSERVER_LOG_INFO(g_logger) << "name=" << getName()
+                                     << " idle stopping exit";
+            break;
+        }
+        if(COSERVER_UNLIKELY(isRetired())) {
+            // 线程已经退休，回到调度循环后退出
+            break;
+        }
+        checkDrainDeadline();
 
+        if(m_polling.exchange(true, std::memory_order_acquire)) {
+            // 其他线程正在 epoll_wait，停放等待单独唤醒
+            parkIdle(MAX_TIMEOUT);
+            if(hasRunnableTask()) {
+                Fiber::GetThisRaw()->swapOut();
+            }
+            continue;
+        }
+
+        // 先标记阻塞再检查任务和定时器，与 tickle / onTimerInsertedAtFront 配合，不会漏掉唤醒
+        m_pollerWorker = currentWorker();
+        m_pollerBlocked = true;
+        next_timeout = hasRunnableTask() ? 0 : std::min(getNextTimer(), getDrainRemainingMs());
         int rt = 0;
         do {
-            static const int MAX_TIMEOUT = 3000;
             if(next_timeout != ~0ull) {
                 next_timeout = (int)next_timeout > MAX_TIMEOUT
                                 ? MAX_TIMEOUT : next_timeout;
             } else {
                 next_timeout = MAX_TIMEOUT;
             }
+            if(m_uring) {
+                waitUring(next_timeout);
+                break;
+            }
+            recordSyscall();
             rt = epoll_wait(m_epfd, events, MAX_EVNETS, (int)next_timeout);
             if(rt < 0 && errno == EINTR) {
             } else {
                 break;
             }
         } while(true);
+        m_pollerBlocked = false;
 
-        std::vector<std::function<void()> > cbs;
+        std::vector<SmallCallable> cbs;
         listExpiredCb(cbs);
         if(!cbs.empty()) {
             COSERVER_LOG_DEBUG(g_logger) << "on timer cbs.size=" << cbs.size();
@@ -371,6 +656,10 @@ void IOManager::idle(){
             cbs.clear();
         }
 
+        if(m_uring) {
+            reapUring(false);
+        }
+
         //if(SYLAR_UNLIKELY(rt == MAX_EVNETS)) {
         //    SYLAR_LOG_INFO(g_logger) << "epoll wait events=" << rt;
         //}
@@ -379,6 +668,7 @@ void IOManager::idle(){
             epoll_event& event = events[i];
             if(event.data.fd == m_tickleFds[0]) {
                 uint8_t dummy[256];
+                recordSyscall();
                 while(read(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
                 continue;
             }
@@ -386,7 +676,7 @@ void IOManager::idle(){
             FdContext* fd_ctx = (FdContext*)event.data.ptr;
             FdContext::MutexType::Lock lock(fd_ctx->mutex);
             if(event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+                event.events |= (EPOLLIN | EPOLLOUT) & (m_persistent ? ~0u : fd_ctx->events);
             }
             int real_events = NONE;
             if(event.events & EPOLLIN) {
@@ -396,20 +686,28 @@ void IOManager::idle(){
                 real_events |= WRITE;
             }
 
+            if(m_persistent) {
+                // 没有等待者的就绪记录下来，之后的 addEvent / consumeReady 直接使用；注册保持不变
+                fd_ctx->ready = (Event)(fd_ctx->ready | (real_events & ~fd_ctx->events));
+                real_events &= fd_ctx->events;
+            }
             if((fd_ctx->events & real_events) == NONE) {
                 continue;
             }
 
-            int left_events = (fd_ctx->events & ~real_events);
-            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            event.events = EPOLLET | left_events;
-
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-            if(rt2) {
-                COSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                    << (EpollCtlOp)op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
-                    << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
-                continue;
+            if(!m_persistent) {
+                int left_events = (fd_ctx->events & ~real_events);
+                int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+                event.events = EPOLLET | left_events;
+
+                recordSyscall();
+                int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
+                if(rt2) {
+                    COSERVER_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+                        << (EpollCtlOp)op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
+                        << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
+                    continue;
+                }
             }
 
             //SYLAR_LOG_INFO(g_logger) << " fd=" << fd_ctx->fd << " events=" << fd_ctx->events
@@ -424,17 +722,175 @@ void IOManager::idle(){
             }
         }
 
-        Fiber::ptr cur = Fiber::GetThis();
-        auto raw_ptr = cur.get();
-        cur.reset();
+        m_pollerWorker = nullptr;
+        m_polling.store(false, std::memory_order_release);
+
+        Fiber::GetThisRaw()->swapOut();
+    }
+}
+
+void IOManager::waitUring(uint64_t timeout_ms){
+    if(m_uring->hasCompletion()) {
+        return;
+    }
+    recordSyscall();
+    m_uring->wait(timeout_ms);
+}
+
+void IOManager::reapUring(bool try_lock){
+    static const size_t MAX_COMPLETIONS = 64;
+    IoCompletion cqes[MAX_COMPLETIONS];
+    while(true) {
+        size_t n = m_uring->reap(cqes, MAX_COMPLETIONS, try_lock);
+        // 收割后在锁外处理，处理中可能提交新的请求
+        for(size_t i = 0; i < n; ++i) {
+            onUringCompletion(cqes[i]);
+        }
+        if(n < MAX_COMPLETIONS) {
+            break;
+        }
+    }
+}
+
+void IOManager::backoffUring(){
+    reapUring(false);
+    sched_yield();
+}
+
+void IOManager::onUringCompletion(const IoCompletion& cqe){
+    uint64_t tag = cqe.userData & URING_TAG_MASK;
+    void* ptr = (void*)(uintptr_t)(cqe.userData & ~(uint64_t)URING_TAG_MASK);
+    switch(tag) {
+        case URING_OP: {
+            UringOp::ptr op;
+            op.swap(((UringOp*)ptr)->kernelRef);
+            op->res = cqe.res;
+            --op->fdCtx->uringOps;
+            if(op->arrived.exchange(true)) {
+                // 提交者已经挂起，先恢复协程再减少计数，stopping 不会在两者之间误判
+                Fiber::ptr fiber = op->fiber;
+                schedule(std::move(fiber));
+            }
+            --m_pendingEventCount;
+            break;
+        }
+        case URING_READ:
+        case URING_WRITE: {
+            Event event = tag == URING_READ ? READ : WRITE;
+            FdContext* fd_ctx = (FdContext*)ptr;
+            FdContext::MutexType::Lock lock(fd_ctx->mutex);
+            // 事件已经被 delEvent / cancelEvent / cancelAll 处理，或是之前注册的 poll
+            if(!(fd_ctx->events & event)) {
+                break;
+            }
+            fd_ctx->triggerEvent(event);
+            --m_pendingEventCount;
+            break;
+        }
+        case URING_CANCEL:
+            if(ptr) {
+                UringOp::ptr op;
+                op.swap(((UringOp*)ptr)->cancelRef);
+            }
+            break;
+        case URING_WAKE: {
+            uint8_t dummy[256];
+            recordSyscall();
+            while(read(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
+            if(!(cqe.flags & IORING_CQE_F_MORE)) {
+                armUringWake();
+            }
+            break;
+        }
+        default:
+            COSERVER_LOG_ERROR(g_logger) << "invalid io_uring completion user_data=" << cqe.userData;
+            break;
+    }
+}
+
+void IOManager::armUringWake(){
+    recordSyscall();
+    bool rt = m_uring->submitPoll(m_tickleFds[0], POLLIN, URING_WAKE, true);
+    COSERVER_ASSERT(rt);
+}
+
+ssize_t IOManager::submitIo(const IoRequest& req, uint64_t timeout_ms){
+    COSERVER_ASSERT(m_uring);
+    FdContext* fd_ctx = getContext(req.fd);
+    UringOp::ptr op(new UringOp);
+    op->fiber = Fiber::GetThis();
+    op->fdCtx = fd_ctx;
+    op->kernelRef = op;
+    while(true) {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        if(COSERVER_UNLIKELY(isDrainExpired())) {
+            op->kernelRef.reset();
+            return -ECANCELED;
+        }
+        // 在句柄锁内提交，与 cancelAll 不会错过
+        ++fd_ctx->uringOps;
+        ++m_pendingEventCount;
+        recordSyscall();
+        if(m_uring->submit(req, (uint64_t)(uintptr_t)op.get() | URING_OP)) {
+            break;
+        }
+        // 提交失败时请求没有进入内核，可以释放
+        int err = errno ? errno : EIO;
+        --fd_ctx->uringOps;
+        --m_pendingEventCount;
+        if(err != EBUSY && err != EAGAIN) {
+            op->kernelRef.reset();
+            return -err;
+        }
+        lock.unlock();
+        backoffUring();
+    }
+
+    Timer::ptr timer;
+    if(timeout_ms != ~0ull) {
+        std::weak_ptr<UringOp> winfo(op);
+        timer = addConditionTimer(timeout_ms, [winfo, this](){
+            // 操作可能已经完成，取消请求找不到目标，只是多一次系统调用
+            UringOp::ptr op = winfo.lock();
+            if(!op) {
+                return;
+            }
+            op->timedOut = true;
+            op->cancelRef = op;
+            while(true) {
+                recordSyscall();
+                if(m_uring->submitCancel((uint64_t)(uintptr_t)op.get() | URING_OP
+                        ,(uint64_t)(uintptr_t)op.get() | URING_CANCEL)) {
+                    break;
+                }
+                if(!UringBusy()) {
+                    op->cancelRef.reset();
+                    break;
+                }
+                backoffUring();
+            }
+        }, winfo);
+    }
 
-        raw_ptr->swapOut();
+    // 数据已经就绪时提交后马上就有完成事件，先收割一次，不用挂起等待 idle
+    reapUring(true);
+    if(!op->arrived.exchange(true)) {
+        Fiber::YieldToHold();
+    }
+    if(timer) {
+        timer->cancel();
     }
+    if(op->res == -ECANCELED && op->timedOut) {
+        return -ETIMEDOUT;
+    }
+    return op->res;
 }
 
 void IOManager::onTimerInsertedAtFront(){
-    // 唤醒 epoll_wait ，重新计算时间
-    tickle();
+    // 唤醒 epoll_wait ，重新计算时间；没有线程在 epoll_wait 时唤醒一个停放的线程接管
+    if(!wakePoller() && !m_polling){
+        wakeOne();
+    }
 }
 
 }
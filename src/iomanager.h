@@ -3,12 +3,20 @@
 
 /**
  *  基于Epoll的IO协程调度器
+ *  可选 io_uring 后端：读写等操作直接提交给内核，完成后恢复协程，不再等待就绪后重新调用
 */
+#include <errno.h>
+#include <memory>
+
 #include "scheduler.h"
 #include "timer.h"
 
 namespace coServer{
 
+class IoUring;
+struct IoRequest;
+struct IoCompletion;
+
 class IOManager : public Scheduler, public TimerManager{
 public:
     typedef std::shared_ptr<IOManager> ptr;
@@ -21,6 +29,14 @@ public:
         WRITE = 0x4
     };
 
+    // IO 后端
+    enum Backend{
+        // 按配置 iomanager.backend 选择
+        BACKEND_CONFIG = 0,
+        BACKEND_EPOLL,
+        BACKEND_IO_URING
+    };
+
 private:
     // 事件上下文类(与一个文件描述符 fd 一一对应)
     struct FdContext{
@@ -29,7 +45,7 @@ private:
         struct EventContext{
             Scheduler* scheduler = nullptr; // 事件执行的调度器
             Fiber::ptr fiber;               // 事件协程
-            std::function<void()> cb;       // 事件回调函数
+            SmallCallable cb;               // 事件回调函数
         };
 
         // 获取事件上下文
@@ -41,6 +57,12 @@ private:
         // 触发事件
         void triggerEvent(Event event);
 
+        /**
+         *  常驻注册模式：句柄上下文的代数变了（fd 在别处关闭后被复用，内核已经删除注册）时
+         *  清除注册和就绪记录，需要持有 mutex
+        */
+        void checkGeneration(uint64_t gen);
+
         // 读事件上下文
         EventContext read;
         // 写事件上下文
@@ -49,12 +71,27 @@ private:
         int fd = 0;
         // 已经注册的事件
         Event events = NONE;
+        // io_uring 后端中已经提交、还没有完成的 IO 操作数
+        std::atomic<uint32_t> uringOps = {0};
+        // 常驻注册模式：是否已经注册到 epoll
+        bool registered = false;
+        // 常驻注册模式：注册时句柄上下文（FdCtx）的代数
+        uint64_t generation = 0;
+        // 常驻注册模式：没有等待者时到达的就绪事件（边沿触发，不会再次通知）
+        Event ready = NONE;
         // 事件的锁
         MutexType mutex;
     };
 
 public:
-    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = "");
+    /**
+     *  threads / use_caller / name : 同 Scheduler
+     *  cpus : 工作线程绑定的 CPU，同 Scheduler
+     *  backend : IO 后端，io_uring 不可用时回退到 epoll
+    */
+    IOManager(size_t threads = 1, bool use_caller = true, const std::string& name = ""
+            ,const std::vector<int>& cpus = std::vector<int>()
+            ,Backend backend = BACKEND_CONFIG);
 
     ~IOManager();
 
@@ -64,7 +101,7 @@ public:
      * event ： 事件类型
      * cb ： 事件回调函数
     */
-    int addEvent(int fd, Event event, std::function<void()> cb=nullptr);
+    int addEvent(int fd, Event event, SmallCallable cb=nullptr);
 
     bool delEvent(int fd, Event event);
 
@@ -72,27 +109,100 @@ public:
 
     bool cancelAll(int fd);
 
+    /**
+     *  常驻注册模式下，fd 在上次等待之后已经就绪时清除就绪标记并返回 true，调用者直接重试，不用挂起
+     *  其他模式总是返回 false
+    */
+    bool consumeReady(int fd, Event event);
+
+    /**
+     *  是否为常驻注册模式（iomanager.epoll_persistent，只对 epoll 后端有效）
+     *  fd 第一次等待时以 EPOLLIN | EPOLLOUT | EPOLLET 注册，直到 cancelAll（hook 的 close）才删除，
+     *  事件触发与等待都不再调用 epoll_ctl；fd 需要通过 hook 的 close 关闭或者先调用 cancelAll
+    */
+    bool isPersistent() const {return m_persistent;}
+
+    // 实际使用的后端
+    Backend getBackend() const {return m_uring ? BACKEND_IO_URING : BACKEND_EPOLL;}
+
+    bool isUring() const {return m_uring != nullptr;}
+
+    /**
+     *  io_uring 后端：提交 IO 操作，挂起当前协程直到完成
+     *  timeout_ms 为 ~0ull 时不超时，超时后取消操作并返回 -ETIMEDOUT
+     *  返回操作结果，失败时为 -errno；drain 超时或 cancelAll 取消时返回 -ECANCELED
+     *  请求引用的缓冲区在返回前一直被内核使用，不能在共享栈协程的栈上
+    */
+    ssize_t submitIo(const IoRequest& req, uint64_t timeout_ms = ~0ull);
+
     static IOManager* GetThis();
 
 protected:
+    /**
+     *  优先唤醒一个停放的线程，没有停放的线程时才唤醒 epoll_wait 中的线程
+     *  同一时刻只有一个空闲线程 epoll_wait，其他空闲线程各自停放，每个新任务只唤醒一个线程
+    */
     void tickle() override;
 
+    void tickleWorker(Worker* worker) override;
+
     bool stopping() override;
 
     void idle() override;
 
-    // 重置socket句柄上下文的容器大小
+    // 重置socket句柄上下文的容器大小，新的位置为空
     void contextResize(size_t size);
 
+    /**
+     *  获取 fd 的上下文，不存在时创建（需要持有写锁）
+     *  上下文在第一次 addEvent 时由调用线程创建，内存落在该线程所在的 NUMA 节点上
+    */
+    FdContext* createContext(int fd);
+
     bool stopping(uint64_t& timeout);
 
+    // drain 超时：取消所有等待中的事件，之后 addEvent 返回 ECANCELED
+    void onDrainDeadline(DrainResult& result) override;
+
     void onTimerInsertedAtFront() override;
+
+    // 通过管道唤醒 epoll_wait 中的线程，已经唤醒过时不再重复写
+    bool wakePoller();
+private:
+    struct UringOp;
+
+    // 获取 fd 的上下文，不存在时创建
+    FdContext* getContext(int fd);
+
+    // io_uring 后端的 idle 等待
+    void waitUring(uint64_t timeout_ms);
+
+    // 收割 io_uring 的完成事件并处理，try_lock 时其他线程正在收割就直接返回
+    void reapUring(bool try_lock);
+
+    /**
+     *  io_uring 提交返回 EBUSY / EAGAIN（完成队列积压）时收割完成事件并让出 CPU，之后调用者重试
+     *  完成事件的处理会加句柄锁，调用时不能持有
+    */
+    void backoffUring();
+
+    static bool UringBusy() {return errno == EBUSY || errno == EAGAIN;}
+
+    void onUringCompletion(const IoCompletion& cqe);
+
+    // 监听唤醒管道（multishot poll，被内核结束后重新提交）
+    void armUringWake();
 private:
-    int m_epfd = 0;         // epoll 文件句柄
+    int m_epfd = -1;        // epoll 文件句柄
+    bool m_persistent = false;                          // epoll 常驻注册模式
     int m_tickleFds[2];     // pipe 文件句柄
     std::atomic<size_t> m_pendingEventCount = {0};      // 当前等待执行的事件数量
     RWMutexType m_mutex;    // IOManager 的读写锁
     std::vector<FdContext*> m_fdContexts;               // 调度器监听的socket事件上下文数组
+    std::atomic<bool> m_polling = {false};              // 是否有线程持有 epoll_wait 的权利
+    std::atomic<bool> m_pollerBlocked = {false};        // 该线程是否阻塞在 epoll_wait 中
+    std::atomic<Worker*> m_pollerWorker = {nullptr};    // 持有 epoll_wait 权利的线程
+    std::unique_ptr<IoUring> m_uring;                   // io_uring 后端，为空时使用 epoll
 };
 
 }
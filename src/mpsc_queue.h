@@ -0,0 +1,75 @@
+#ifndef __MPSC_QUEUE_H__
+#define __MPSC_QUEUE_H__
+
+#include <atomic>
+
+#include "noncopyable.h"
+
+namespace coServer{
+
+/**
+ *  侵入式无锁多生产者单消费者队列（Dmitry Vyukov）
+ *  节点类型 T 需要有 std::atomic<T*> next 成员并且可以默认构造（用作哨兵节点），
+ *  入队只做一次原子交换，不加锁也不申请内存
+ *  push 可以被多个线程同时调用；pop 同一时刻只能有一个线程调用，多个消费者需要自己互斥
+*/
+template<class T>
+class MpscQueue : Noncopyable{
+public:
+    MpscQueue()
+        :m_head(&m_stub)
+        ,m_tail(&m_stub){
+        m_stub.next.store(nullptr, std::memory_order_relaxed);
+    }
+
+    void push(T* node){
+        node->next.store(nullptr, std::memory_order_relaxed);
+        T* prev = m_head.exchange(node, std::memory_order_acq_rel);
+        // 在这两步之间消费者看到的链表是断开的，pop 会返回 nullptr
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // 取出队首节点，队列为空或生产者正在入队时返回 nullptr
+    T* pop(){
+        T* tail = m_tail;
+        T* next = tail->next.load(std::memory_order_acquire);
+        if(tail == &m_stub){
+            if(!next){
+                return nullptr;
+            }
+            m_tail = next;
+            tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if(next){
+            m_tail = next;
+            return tail;
+        }
+        T* head = m_head.load(std::memory_order_acquire);
+        if(tail != head){
+            return nullptr;
+        }
+        // 只剩最后一个节点，重新放入哨兵后才能把它取出
+        push(&m_stub);
+        next = tail->next.load(std::memory_order_acquire);
+        if(next){
+            m_tail = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+    // 近似判断是否为空
+    bool empty() const{
+        return m_head.load(std::memory_order_acquire) == &m_stub
+            && !m_stub.next.load(std::memory_order_acquire);
+    }
+private:
+    std::atomic<T*> m_head;
+    T* m_tail;
+    T m_stub;
+};
+
+}
+
+#endif
@@ -227,6 +227,11 @@ public:
         pthread_spin_lock(&m_mutex);
     }
 
+    // 获取锁失败时直接返回 false
+    bool tryLock(){
+        return !pthread_spin_trylock(&m_mutex);
+    }
+
     void unlock(){
         pthread_spin_unlock(&m_mutex);
     }
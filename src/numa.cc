@@ -0,0 +1,80 @@
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <string>
+
+#include "numa.h"
+#include "log.h"
+
+namespace coServer{
+
+static Logger::ptr g_logger = COSERVER_LOG_NAME("system");
+
+static thread_local int t_numa_node = -1;
+
+int GetCpuCount(){
+    static int s_cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    return s_cpu_count;
+}
+
+int GetNumaNodeOfCpu(int cpu){
+    // /sys/devices/system/cpu/cpuN/ 下有指向所在节点的 nodeM 链接
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR* dir = opendir(path.c_str());
+    if(!dir){
+        return -1;
+    }
+    int node = -1;
+    while(struct dirent* ent = readdir(dir)){
+        if(!strncmp(ent->d_name, "node", 4) && ent->d_name[4] >= '0' && ent->d_name[4] <= '9'){
+            node = atoi(ent->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+bool BindThreadToCpu(int cpu){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(rt){
+        COSERVER_LOG_ERROR(g_logger) << "pthread_setaffinity_np cpu=" << cpu
+            << " rt=" << rt << " " << strerror(rt);
+        return false;
+    }
+    t_numa_node = GetNumaNodeOfCpu(cpu);
+    return true;
+}
+
+int GetCurrentNumaNode(){
+    return t_numa_node;
+}
+
+bool BindMemoryToNode(void* addr, size_t len, int node){
+    if(node < 0){
+        return false;
+    }
+    const size_t bits = sizeof(unsigned long) * 8;
+    unsigned long mask[4] = {0};
+    if((size_t)node >= bits * 4){
+        return false;
+    }
+    mask[node / bits] = 1ul << (node % bits);
+    if(syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, bits * 4 + 1, 0)){
+        COSERVER_LOG_ERROR(g_logger) << "mbind(" << addr << ", " << len << ", node=" << node
+            << ") errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+}
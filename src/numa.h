@@ -0,0 +1,37 @@
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include <stddef.h>
+
+namespace coServer{
+
+/**
+ *  CPU 亲和性与 NUMA 节点
+ *  直接读取 /sys 并使用系统调用，不依赖 libnuma；
+ *  不支持 NUMA 的机器上节点号为 -1，相关操作什么也不做
+*/
+
+// 在线 CPU 数量
+int GetCpuCount();
+
+// CPU 所在的 NUMA 节点，未知时返回 -1
+int GetNumaNodeOfCpu(int cpu);
+
+/**
+ *  把当前线程绑定到 cpu 上，并记录当前线程所在的 NUMA 节点
+ *  返回是否成功
+*/
+bool BindThreadToCpu(int cpu);
+
+// 当前线程绑定的 NUMA 节点，没有绑定时返回 -1
+int GetCurrentNumaNode();
+
+/**
+ *  让 [addr, addr + len) 的物理页优先从 node 节点分配（MPOL_PREFERRED）
+ *  只影响之后第一次访问时分配的页，node 为 -1 时直接返回
+*/
+bool BindMemoryToNode(void* addr, size_t len, int node);
+
+}
+
+#endif
@@ -0,0 +1,173 @@
+#include <algorithm>
+
+#include "offload.h"
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+#include "scheduler.h"
+#include "util.h"
+
+namespace coServer{
+
+static Logger::ptr g_logger = COSERVER_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_offload_threads =
+    Config::Lookup<uint32_t>("offload.threads", 4, "default offload pool threads");
+static ConfigVar<uint32_t>::ptr g_offload_queue_size =
+    Config::Lookup<uint32_t>("offload.queue_size", 1024, "default offload pool max queued tasks, 0 means unlimited");
+
+void OffloadPool::Waiter::wait(){
+    if(fiber){
+        // 恢复执行前调度器不能停止，否则完成后重新调度时调度器可能已经析构
+        scheduler->beginExternalWait();
+        Fiber::YieldToHold();
+        scheduler->endExternalWait();
+    }
+    else{
+        sem.wait();
+    }
+}
+
+void OffloadPool::Waiter::wake(){
+    // 唤醒后调用者可能马上返回，Waiter 随之析构，不能再访问成员
+    if(fiber){
+        Fiber::ptr f = fiber;
+        scheduler->schedule(std::move(f));
+    }
+    else{
+        sem.notify();
+    }
+}
+
+OffloadPool::OffloadPool(size_t threads, size_t max_queue, const std::string& name)
+    :m_name(name)
+    ,m_maxQueue(max_queue){
+    COSERVER_ASSERT(threads > 0);
+    for(size_t i = 0; i < threads; ++i){
+        m_threads.push_back(Thread::ptr(new Thread(std::bind(&OffloadPool::work, this)
+                        ,m_name + "_" + std::to_string(i))));
+    }
+}
+
+OffloadPool::~OffloadPool(){
+    stop();
+}
+
+void OffloadPool::run(std::function<void()> cb){
+    std::unique_ptr<Waiter> waiter(new Waiter);
+    Scheduler* sc = Scheduler::GetThis();
+    if(sc && Fiber::GetThisRaw() != Scheduler::GetMainFiber()){
+        waiter->fiber = Fiber::GetThis();
+        waiter->scheduler = sc;
+    }
+
+    MutexType::Lock lock(m_mutex);
+    while(m_maxQueue && m_queueSize >= m_maxQueue && !m_stopping){
+        ++m_queueFullWaits;
+        m_blocked.push_back(waiter.get());
+        lock.unlock();
+        waiter->wait();
+        lock.lock();
+    }
+    if(m_stopping){
+        lock.unlock();
+        COSERVER_LOG_WARN(g_logger) << "offload pool " << m_name << " stopped, run in caller";
+        cb();
+        return;
+    }
+    m_tasks.push_back(Task{std::move(cb), waiter.get(), GetCurrentUS()});
+    ++m_queueSize;
+    lock.unlock();
+    m_sem.notify();
+    waiter->wait();
+}
+
+void OffloadPool::work(){
+    while(true){
+        m_sem.wait();
+        Waiter* blocked = nullptr;
+        Task task;
+        {
+            MutexType::Lock lock(m_mutex);
+            if(m_tasks.empty()){
+                if(m_stopping){
+                    break;
+                }
+                continue;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+            --m_queueSize;
+            if(!m_blocked.empty()){
+                blocked = m_blocked.front();
+                m_blocked.pop_front();
+            }
+        }
+        if(blocked){
+            // 让出一个空位，唤醒一个等待的调用者
+            blocked->wake();
+        }
+
+        uint64_t begin = GetCurrentUS();
+        m_waitTime.record(begin - task.enqueueUs);
+        ++m_activeCount;
+        try{
+            task.cb();
+        }catch(std::exception& ex){
+            COSERVER_LOG_ERROR(g_logger) << "offload pool " << m_name << " task except: " << ex.what();
+        }catch(...){
+            COSERVER_LOG_ERROR(g_logger) << "offload pool " << m_name << " task except";
+        }
+        task.cb = nullptr;
+        --m_activeCount;
+        ++m_completed;
+        m_runTime.record(GetCurrentUS() - begin);
+        task.waiter->wake();
+    }
+}
+
+void OffloadPool::stop(){
+    std::vector<Thread::ptr> thrs;
+    std::list<Waiter*> blocked;
+    {
+        MutexType::Lock lock(m_mutex);
+        if(m_stopping){
+            return;
+        }
+        m_stopping = true;
+        thrs.swap(m_threads);
+        blocked.swap(m_blocked);
+    }
+    // 等待空位的调用者改为在自己的线程中执行
+    for(auto i : blocked){
+        i->wake();
+    }
+    for(size_t i = 0; i < thrs.size(); ++i){
+        m_sem.notify();
+    }
+    for(auto& i : thrs){
+        i->join();
+    }
+}
+
+std::ostream& OffloadPool::dump(std::ostream& os) const{
+    os << "[OffloadPool name=" << m_name
+       << " threads=" << m_threads.size()
+       << " queue=" << m_queueSize
+       << " active=" << m_activeCount
+       << " completed=" << m_completed
+       << " queue_full_waits=" << m_queueFullWaits << "]" << std::endl;
+    os << "wait ";
+    m_waitTime.dump(os, "us");
+    os << "run ";
+    return m_runTime.dump(os, "us");
+}
+
+OffloadPool* OffloadPool::GetDefault(){
+    // 不析构，进程退出时其他线程可能还在使用
+    static OffloadPool* s_pool = new OffloadPool(std::max(1u, g_offload_threads->getValue())
+            ,g_offload_queue_size->getValue(), "offload");
+    return s_pool;
+}
+
+}
@@ -0,0 +1,166 @@
+#ifndef __OFFLOAD_H__
+#define __OFFLOAD_H__
+
+#include <exception>
+#include <functional>
+#include <list>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "fiber.h"
+#include "histogram.h"
+#include "mutex.h"
+#include "thread.h"
+
+namespace coServer{
+
+class Scheduler;
+
+/**
+ *  阻塞调用卸载线程池
+ *  hook 只对 socket 生效，普通文件读写、CPU 密集计算、第三方库的阻塞调用会卡住整个 IO 线程；
+ *  把这些调用交给独立的线程执行，调用的协程挂起，完成后回到原来的调度器上继续执行
+ *  线程数和队列长度都有上限，队列满时提交的协程挂起等待空位，慢磁盘不会拖垮网络线程
+*/
+class OffloadPool : Noncopyable{
+public:
+    typedef std::shared_ptr<OffloadPool> ptr;
+
+    /**
+     *  threads : 执行阻塞调用的线程数
+     *  max_queue : 排队的最大任务数，0 表示不限制
+    */
+    OffloadPool(size_t threads, size_t max_queue, const std::string& name = "offload");
+    ~OffloadPool();
+
+    /**
+     *  在线程池中执行 cb，返回时 cb 已经执行完
+     *  在调度器的协程中调用时挂起当前协程，完成后重新调度到原来的调度器；
+     *  其他情况（普通线程、调度协程）阻塞当前线程等待
+     *  cb 抛出的异常不会传播，需要结果和异常时使用 offload()
+     *  共享栈协程切出后栈上的地址会被其他协程覆盖，cb 不能引用共享栈协程栈上的变量
+    */
+    void run(std::function<void()> cb);
+
+    // 停止线程池，等待已经提交的任务执行完
+    void stop();
+
+    const std::string& getName() const {return m_name;}
+
+    size_t getThreadCount() const {return m_threads.size();}
+
+    // 排队中的任务数
+    size_t getQueueSize() const {return m_queueSize;}
+
+    // 正在执行的任务数
+    size_t getActiveCount() const {return m_activeCount;}
+
+    // 执行完的任务数
+    uint64_t getCompleted() const {return m_completed;}
+
+    // 因队列已满等待空位的次数
+    uint64_t getQueueFullWaits() const {return m_queueFullWaits;}
+
+    // 任务排队时间（微秒）
+    const Histogram& getWaitTime() const {return m_waitTime;}
+
+    // 任务执行时间（微秒）
+    const Histogram& getRunTime() const {return m_runTime;}
+
+    // 输出线程池的统计
+    std::ostream& dump(std::ostream& os) const;
+
+    // 默认线程池，线程数与队列长度取 offload.threads、offload.queue_size，第一次使用时创建
+    static OffloadPool* GetDefault();
+private:
+    // 等待任务完成或队列空位的调用者：调度器中的协程，或者阻塞等待的线程
+    // 分配在堆上，调用者可能是共享栈协程
+    struct Waiter{
+        Fiber::ptr fiber;
+        Scheduler* scheduler = nullptr;
+        Semaphore sem;
+
+        // 挂起当前协程 / 线程直到 wake
+        void wait();
+        void wake();
+    };
+
+    struct Task{
+        std::function<void()> cb;
+        Waiter* waiter;
+        uint64_t enqueueUs;
+    };
+
+    // 线程池线程的执行函数
+    void work();
+private:
+    typedef Mutex MutexType;
+    MutexType m_mutex;
+    std::string m_name;
+    size_t m_maxQueue;
+    std::vector<Thread::ptr> m_threads;
+    std::list<Task> m_tasks;
+    // 等待队列空位的调用者
+    std::list<Waiter*> m_blocked;
+    // 每个任务 notify 一次，停止时每个线程再 notify 一次
+    Semaphore m_sem;
+    bool m_stopping = false;
+    std::atomic<size_t> m_queueSize = {0};
+    std::atomic<size_t> m_activeCount = {0};
+    std::atomic<uint64_t> m_completed = {0};
+    std::atomic<uint64_t> m_queueFullWaits = {0};
+    Histogram m_waitTime;
+    Histogram m_runTime;
+};
+
+/**
+ *  在默认卸载线程池中执行 fn 并返回它的结果，fn 抛出的异常在调用方重新抛出
+ *  例如：ssize_t n = coServer::offload([fd, buf, len, off](){ return ::pread(fd, buf, len, off); });
+ *  fn、结果和异常都放在堆上，调用者是共享栈协程时也可以使用
+*/
+template<class F>
+typename std::enable_if<!std::is_void<typename std::result_of<F()>::type>::value
+    ,typename std::result_of<F()>::type>::type offload(F&& fn){
+    typedef typename std::result_of<F()>::type R;
+    struct State{
+        typename std::decay<F>::type fn;
+        std::unique_ptr<R> result;
+        std::exception_ptr error;
+    };
+    std::shared_ptr<State> state(new State{std::forward<F>(fn), nullptr, nullptr});
+    OffloadPool::GetDefault()->run([state](){
+        try{
+            state->result.reset(new R(state->fn()));
+        }catch(...){
+            state->error = std::current_exception();
+        }
+    });
+    if(state->error){
+        std::rethrow_exception(state->error);
+    }
+    return std::move(*state->result);
+}
+
+template<class F>
+typename std::enable_if<std::is_void<typename std::result_of<F()>::type>::value>::type offload(F&& fn){
+    struct State{
+        typename std::decay<F>::type fn;
+        std::exception_ptr error;
+    };
+    std::shared_ptr<State> state(new State{std::forward<F>(fn), nullptr});
+    OffloadPool::GetDefault()->run([state](){
+        try{
+            state->fn();
+        }catch(...){
+            state->error = std::current_exception();
+        }
+    });
+    if(state->error){
+        std::rethrow_exception(state->error);
+    }
+}
+
+}
+
+#endif
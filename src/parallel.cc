@@ -0,0 +1,78 @@
+#include "parallel.h"
+#include "log.h"
+#include "macro.h"
+
+namespace coServer{
+
+void TaskGroup::State::setError(std::exception_ptr e){
+    Mutex::Lock lock(mutex);
+    if(!error){
+        error = e;
+    }
+}
+
+void TaskGroup::State::done(){
+    if(--pending != 0){
+        return;
+    }
+    // 等待者已经挂起或即将挂起，唤醒后它可能马上析构 TaskGroup，这里只使用局部变量
+    if(fiber){
+        Fiber::ptr f = fiber;
+        scheduler->schedule(std::move(f));
+    }
+    else{
+        sem.notify();
+    }
+}
+
+TaskGroup::TaskGroup(Scheduler* sc)
+    :m_scheduler(sc ? sc : Scheduler::GetThis())
+    ,m_state(new State){
+    COSERVER_ASSERT2(m_scheduler, "TaskGroup needs a scheduler");
+}
+
+TaskGroup::~TaskGroup(){
+    join();
+}
+
+void TaskGroup::wait(){
+    std::exception_ptr error = join();
+    if(error){
+        std::rethrow_exception(error);
+    }
+}
+
+std::exception_ptr TaskGroup::join(){
+    State* state = m_state.get();
+    Scheduler* sc = Scheduler::GetThis();
+    bool in_fiber = sc && Fiber::GetThisRaw() != Scheduler::GetMainFiber();
+    if(in_fiber){
+        state->fiber = Fiber::GetThis();
+        state->scheduler = sc;
+        // 恢复执行前当前调度器不能停止
+        sc->beginExternalWait();
+    }
+    else{
+        state->fiber = nullptr;
+    }
+    if(--state->pending != 0){
+        if(in_fiber){
+            Fiber::YieldToHold();
+        }
+        else{
+            state->sem.wait();
+        }
+    }
+    if(in_fiber){
+        sc->endExternalWait();
+    }
+    state->fiber = nullptr;
+    state->pending = 1;
+
+    Mutex::Lock lock(state->mutex);
+    std::exception_ptr error = state->error;
+    state->error = nullptr;
+    return error;
+}
+
+}
@@ -0,0 +1,221 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "fiber.h"
+#include "mutex.h"
+#include "noncopyable.h"
+#include "scheduler.h"
+
+namespace coServer{
+
+/**
+ *  fork/join 任务组
+ *  run 把任务提交到调度器，wait 等待所有任务完成；在调度器的协程中等待时挂起当前协程，
+ *  线程继续执行其他任务（包括本组的任务），不会像 Semaphore 那样阻塞整个线程
+ *  任务抛出的第一个异常在 wait 中重新抛出
+ *  任务计数等状态分配在堆上，调用者是共享栈协程时也可以使用；任务本身不能引用共享栈协程栈上的变量
+*/
+class TaskGroup : Noncopyable{
+public:
+    // sc : 执行任务的调度器，为空时使用当前线程的调度器
+    explicit TaskGroup(Scheduler* sc = nullptr);
+
+    // 析构前等待所有任务完成（不抛出异常）
+    ~TaskGroup();
+
+    template<class F>
+    void run(F&& fn){
+        ++m_state->pending;
+        std::shared_ptr<State> state = m_state;
+        typename std::decay<F>::type f(std::forward<F>(fn));
+        m_scheduler->schedule([state, f]() mutable{
+            try{
+                f();
+            }catch(...){
+                state->setError(std::current_exception());
+            }
+            state->done();
+        });
+    }
+
+    // 等待已经提交的任务全部完成，之后可以继续 run
+    void wait();
+
+    Scheduler* getScheduler() const {return m_scheduler;}
+private:
+    struct State{
+        // 未完成的任务数，加上等待者自己持有的 1
+        std::atomic<size_t> pending = {1};
+        Fiber::ptr fiber;
+        Scheduler* scheduler = nullptr;
+        Semaphore sem;
+        Mutex mutex;
+        std::exception_ptr error;
+
+        void setError(std::exception_ptr e);
+        // 一个任务完成，最后一个完成的唤醒等待者
+        void done();
+    };
+    // 等待所有任务完成，返回第一个异常
+    std::exception_ptr join();
+private:
+    Scheduler* m_scheduler;
+    std::shared_ptr<State> m_state;
+};
+
+namespace detail{
+
+// 自适应分块：每次领取剩余数量的 1/(2*workers)，不少于 grain，开始时块大，结束时块小，负载更均衡
+struct ChunkRange{
+    std::atomic<size_t> next = {0};
+    size_t count = 0;
+    size_t workers = 1;
+    size_t grain = 1;
+
+    // 领取下一块 [begin, end)，没有剩余时返回 false
+    bool take(size_t& begin, size_t& end){
+        size_t cur = next.load(std::memory_order_relaxed);
+        while(cur < count){
+            size_t n = std::max(grain, (count - cur) / (2 * workers));
+            size_t to = std::min(count, cur + n);
+            if(next.compare_exchange_weak(cur, to, std::memory_order_relaxed)){
+                begin = cur;
+                end = to;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+inline size_t ParallelWorkers(Scheduler* sc, size_t count, size_t grain){
+    size_t threads = std::max<size_t>(1, sc->getThreadCount());
+    size_t chunks = (count + grain - 1) / grain;
+    return std::max<size_t>(1, std::min(threads, chunks));
+}
+
+}
+
+/**
+ *  并行执行 fn(i)，i 取 [begin, end)（整数或随机访问迭代器）
+ *  sc : 执行的调度器，为空时使用当前线程的调度器，都没有时在当前线程顺序执行
+ *  grain : 每次领取的最少元素数，单个元素很轻时调大以减少领取的开销
+ *  调用者也参与执行，剩余的工作线程数按调度器线程数确定；返回时所有 fn 都已执行完
+*/
+template<class Index, class F>
+void ParallelFor(Scheduler* sc, Index begin, Index end, F fn, size_t grain = 1){
+    if(!(begin < end)){
+        return;
+    }
+    if(!sc){
+        sc = Scheduler::GetThis();
+    }
+    grain = std::max<size_t>(1, grain);
+    struct Shared{
+        detail::ChunkRange range;
+        F fn;
+        Index begin;
+
+        explicit Shared(const F& f) : fn(f){}
+
+        void work(){
+            size_t b = 0, e = 0;
+            while(range.take(b, e)){
+                for(size_t i = b; i < e; ++i){
+                    fn((Index)(begin + i));
+                }
+            }
+        }
+    };
+    std::shared_ptr<Shared> shared(new Shared(fn));
+    shared->range.count = (size_t)(end - begin);
+    shared->range.grain = grain;
+    shared->range.workers = sc ? detail::ParallelWorkers(sc, shared->range.count, grain) : 1;
+    shared->begin = begin;
+    if(!sc || shared->range.workers == 1){
+        shared->work();
+        return;
+    }
+
+    TaskGroup group(sc);
+    for(size_t i = 1; i < shared->range.workers; ++i){
+        group.run([shared](){
+            shared->work();
+        });
+    }
+    shared->work();
+    group.wait();
+}
+
+/**
+ *  并行归约：对 [begin, end) 中的每个 i 计算 map(i)，用 reduce 合并，init 为单位元
+ *  每个执行者先在本地合并，最后由调用者合并各执行者的结果；reduce 需要满足结合律
+*/
+template<class T, class Index, class Map, class Reduce>
+T ParallelReduce(Scheduler* sc, Index begin, Index end, const T& init
+        ,Map map, Reduce reduce, size_t grain = 1){
+    if(!(begin < end)){
+        return init;
+    }
+    if(!sc){
+        sc = Scheduler::GetThis();
+    }
+    grain = std::max<size_t>(1, grain);
+    struct Shared{
+        detail::ChunkRange range;
+        Map map;
+        Reduce reduce;
+        Index begin;
+        std::vector<T> partial;
+
+        Shared(const Map& m, const Reduce& r) : map(m), reduce(r){}
+
+        void work(size_t slot){
+            // 先在局部变量中累加，避免相邻槽位的伪共享
+            size_t b = 0, e = 0;
+            T acc = partial[slot];
+            while(range.take(b, e)){
+                for(size_t i = b; i < e; ++i){
+                    acc = reduce(acc, map((Index)(begin + i)));
+                }
+            }
+            partial[slot] = acc;
+        }
+    };
+    std::shared_ptr<Shared> shared(new Shared(map, reduce));
+    shared->range.count = (size_t)(end - begin);
+    shared->range.grain = grain;
+    shared->range.workers = sc ? detail::ParallelWorkers(sc, shared->range.count, grain) : 1;
+    shared->begin = begin;
+    shared->partial.assign(shared->range.workers, init);
+    if(!sc || shared->range.workers == 1){
+        shared->work(0);
+        return shared->partial[0];
+    }
+
+    TaskGroup group(sc);
+    for(size_t i = 1; i < shared->range.workers; ++i){
+        group.run([shared, i](){
+            shared->work(i);
+        });
+    }
+    shared->work(0);
+    group.wait();
+
+    T rt = shared->partial[0];
+    for(size_t i = 1; i < shared->partial.size(); ++i){
+        rt = reduce(rt, shared->partial[i]);
+    }
+    return rt;
+}
+
+}
+
+#endif
@@ -0,0 +1,53 @@
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#include "parker.h"
+#include "util.h"
+
+namespace coServer{
+
+static long FutexWait(std::atomic<int>* addr, int expected, const struct timespec* timeout){
+    return syscall(SYS_futex, (int*)addr, FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+}
+
+static long FutexWake(std::atomic<int>* addr, int count){
+    return syscall(SYS_futex, (int*)addr, FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+bool Parker::park(uint64_t timeout_ms){
+    if(m_state.exchange(0, std::memory_order_acquire) == 1){
+        return true;
+    }
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+    while(true){
+        struct timespec ts;
+        struct timespec* pts = nullptr;
+        if(deadline != ~0ull){
+            uint64_t now = GetCurrentMS();
+            if(now >= deadline){
+                return false;
+            }
+            uint64_t left = deadline - now;
+            ts.tv_sec = left / 1000;
+            ts.tv_nsec = (left % 1000) * 1000000;
+            pts = &ts;
+        }
+        FutexWait(&m_state, 0, pts);
+        // 被唤醒、超时、EINTR 或伪唤醒，都以状态为准
+        if(m_state.exchange(0, std::memory_order_acquire) == 1){
+            return true;
+        }
+    }
+}
+
+void Parker::unpark(){
+    if(m_state.exchange(1, std::memory_order_release) == 0){
+        FutexWake(&m_state, 1);
+    }
+}
+
+}
@@ -0,0 +1,34 @@
+#ifndef __PARKER_H__
+#define __PARKER_H__
+
+#include <stdint.h>
+#include <atomic>
+
+#include "noncopyable.h"
+
+namespace coServer{
+
+/**
+ *  线程停放器（futex）
+ *  每个线程一个，unpark 只唤醒停放在它上面的线程；
+ *  先 unpark 后 park 时 park 立即返回，不会丢失唤醒
+*/
+class Parker : Noncopyable{
+public:
+    /**
+     *  停放当前线程
+     *  timeout_ms : 超时时间（毫秒），~0ull 表示一直等待
+     *  返回是否被 unpark 唤醒，超时返回 false
+    */
+    bool park(uint64_t timeout_ms = ~0ull);
+
+    // 唤醒停放的线程
+    void unpark();
+private:
+    // 0 : 没有通知，1 : 有未消费的通知
+    std::atomic<int> m_state {0};
+};
+
+}
+
+#endif
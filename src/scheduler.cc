@@ -1,19 +1,295 @@
+#include <algorithm>
+
 #include "scheduler.h"
 #include "log.h"
 #include "macro.h"
 #include "config.h"
 #include "hook.h"
+#include "numa.h"
+#include "parker.h"
 
 namespace coServer{
     
 static Logger::ptr g_logger = COSERVER_LOG_NAME("system");
 
+static ConfigVar<uint32_t>::ptr g_fiber_pool_size =
+    Config::Lookup<uint32_t>("scheduler.fiber_pool_size", 64, "scheduler per thread terminated fiber pool size");
+
+static ConfigVar<uint32_t>::ptr g_local_queue_size =
+    Config::Lookup<uint32_t>("scheduler.local_queue_size", 256, "scheduler per thread run queue capacity");
+
+static ConfigVar<uint32_t>::ptr g_idle_spin_us =
+    Config::Lookup<uint32_t>("scheduler.idle_spin_us", 50, "scheduler idle thread spin time(us) before parking");
+
+static ConfigVar<std::vector<int> >::ptr g_cpu_affinity =
+    Config::Lookup<std::vector<int> >("scheduler.cpu_affinity", std::vector<int>(), "scheduler worker thread N bind to cpu_affinity[N % size], empty means no binding");
+
+static ConfigVar<uint32_t>::ptr g_starvation_interval =
+    Config::Lookup<uint32_t>("scheduler.starvation_interval", 16, "scheduler takes lower priority tasks first every N picks, 0 means strict priority");
+
+static ConfigVar<uint32_t>::ptr g_max_threads =
+    Config::Lookup<uint32_t>("scheduler.max_threads", 256, "scheduler max worker threads including runtime resize");
+
+static ConfigVar<std::map<std::string, uint32_t> >::ptr g_threads =
+    Config::Lookup("scheduler.threads", std::map<std::string, uint32_t>(), "scheduler name -> worker threads, resize the running scheduler");
+
+static ConfigVar<uint32_t>::ptr g_run_next_limit =
+    Config::Lookup<uint32_t>("scheduler.run_next_limit", 8, "scheduler runs at most N woken fibers in a row from the run next slot, 0 disables the slot");
+
+static ConfigVar<bool>::ptr g_stats =
+    Config::Lookup<bool>("scheduler.stats", false, "scheduler collects wait/run time histograms and counters");
+
+static ConfigVar<uint32_t>::ptr g_stats_sample =
+    Config::Lookup<uint32_t>("scheduler.stats_sample", 32, "scheduler records wait/run time for 1 of every N tasks, 1 means all");
+
+static std::atomic<uint32_t> s_fiber_pool_size {64};
+static std::atomic<uint32_t> s_idle_spin_us {50};
+static std::atomic<uint32_t> s_starvation_interval {16};
+static std::atomic<uint32_t> s_run_next_limit {8};
+static std::atomic<bool> s_stats {false};
+static std::atomic<uint32_t> s_stats_sample {32};
+
+struct _SchedulerIniter{
+    _SchedulerIniter(){
+        s_fiber_pool_size = g_fiber_pool_size->getValue();
+        g_fiber_pool_size->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            COSERVER_LOG_INFO(g_logger) << "scheduler fiber pool size changed from "
+                << old_value << " to " << new_value;
+            s_fiber_pool_size = new_value;
+        });
+        s_idle_spin_us = g_idle_spin_us->getValue();
+        g_idle_spin_us->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            COSERVER_LOG_INFO(g_logger) << "scheduler idle spin changed from "
+                << old_value << "us to " << new_value << "us";
+            s_idle_spin_us = new_value;
+        });
+        s_starvation_interval = g_starvation_interval->getValue();
+        g_starvation_interval->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            COSERVER_LOG_INFO(g_logger) << "scheduler starvation interval changed from "
+                << old_value << " to " << new_value;
+            s_starvation_interval = new_value;
+        });
+        s_run_next_limit = g_run_next_limit->getValue();
+        g_run_next_limit->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            COSERVER_LOG_INFO(g_logger) << "scheduler run next limit changed from "
+                << old_value << " to " << new_value;
+            s_run_next_limit = new_value;
+        });
+        s_stats = g_stats->getValue();
+        g_stats->addListener([](const bool& old_value, const bool& new_value){
+            COSERVER_LOG_INFO(g_logger) << "scheduler stats changed from "
+                << old_value << " to " << new_value;
+            s_stats = new_value;
+        });
+        s_stats_sample = g_stats_sample->getValue();
+        g_stats_sample->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            COSERVER_LOG_INFO(g_logger) << "scheduler stats sample changed from "
+                << old_value << " to " << new_value;
+            s_stats_sample = new_value;
+        });
+    }
+};
+
+static _SchedulerIniter s_scheduler_initer;
+
 // 线程局部变量，记录协程调度器
 static thread_local Scheduler* t_scheduler = nullptr;
 // 记录协程调度器正在执行的协程
 static thread_local Fiber* t_scheduler_fiber = nullptr;
 
-Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
+// 自旋等待时降低功耗，并让出流水线给同一物理核上的另一个超线程
+static inline void CpuRelax(){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// 是否收集调度统计，编译时关闭后恒为 false，统计代码整体被优化掉
+static inline bool StatsEnabled(){
+#ifdef COSERVER_DISABLE_SCHEDULER_STATS
+    return false;
+#else
+    return s_stats.load(std::memory_order_relaxed);
+#endif
+}
+
+/**
+ *  当前入队的任务是否采样等待 / 运行时间
+ *  读一次单调时钟约几十纳秒，与一次协程切换相当，每个任务都计时开销太大，按 scheduler.stats_sample 抽样
+*/
+static inline bool StatsSampled(uint32_t& tick){
+    if(!StatsEnabled() || ++tick < s_stats_sample.load(std::memory_order_relaxed)){
+        return false;
+    }
+    tick = 0;
+    return true;
+}
+
+// 非调度线程提交任务时的采样计数，调度线程使用 Worker::statsTick（共享库中访问线程局部变量较慢）
+static thread_local uint32_t t_stats_tick = 0;
+
+// 只有一个线程写入的计数，不需要原子加
+static inline void IncLocal(std::atomic<uint64_t>& v){
+    v.store(v.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// 每执行这么多次调度先检查一次全局队列，本地队列一直有任务时全局队列也不会饿死
+static const uint32_t s_global_check_interval = 61;
+
+/**
+ *  工作线程
+ *  本地任务队列是固定容量的环形队列：所属线程从尾部压入、从头部取出（FIFO），
+ *  空闲线程也从头部窃取；不用 LIFO，否则不断重新提交自己的任务会让先入队的任务一直得不到执行；
+ *  队列只放没有指定线程的任务
+*/
+struct Scheduler::Worker{
+    Worker(size_t capacity)
+        :tasks(capacity ? capacity : 1){
+    }
+
+    size_t size() const {return count.load(std::memory_order_relaxed);}
+
+    bool pushBack(FiberAndThread* ft){
+        SpinLock::Lock lock(mutex);
+        size_t n = count.load(std::memory_order_relaxed);
+        if(n == tasks.size()){
+            return false;
+        }
+        tasks[(head + n) % tasks.size()] = ft;
+        count.store(n + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    FiberAndThread* popFront(){
+        if(!size()){
+            return nullptr;
+        }
+        SpinLock::Lock lock(mutex);
+        size_t n = count.load(std::memory_order_relaxed);
+        if(!n){
+            return nullptr;
+        }
+        FiberAndThread* ft = tasks[head];
+        head = (head + 1) % tasks.size();
+        count.store(n - 1, std::memory_order_relaxed);
+        return ft;
+    }
+
+    // 从头部取出一半（至少一个）任务
+    size_t stealHalf(std::vector<FiberAndThread*>& out){
+        SpinLock::Lock lock(mutex);
+        size_t n = count.load(std::memory_order_relaxed);
+        size_t steal = (n + 1) / 2;
+        for(size_t i = 0; i < steal; ++i){
+            out.push_back(tasks[head]);
+            head = (head + 1) % tasks.size();
+        }
+        count.store(n - steal, std::memory_order_relaxed);
+        return steal;
+    }
+
+    // 窃取时选择起始位置的伪随机数
+    uint32_t random(){
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    }
+
+    SpinLock mutex;
+    std::vector<FiberAndThread*> tasks;
+    size_t head = 0;
+    std::atomic<size_t> count = {0};
+    // 指定在该线程执行的任务，任意线程入队，只有所属线程出队
+    MpscQueue<FiberAndThread> pinned;
+    std::atomic<size_t> pinnedCount = {0};
+    // 绑定的线程id，线程启动后设置
+    std::atomic<int> thread = {-1};
+    // 是否处于空闲状态
+    std::atomic<bool> idle = {false};
+    // 空闲时在这里停放
+    Parker parker;
+    // 是否在空闲线程栈中（m_idleLock 保护）
+    bool parked = false;
+    // 绑定的 CPU 与所在的 NUMA 节点，-1 表示不绑定 / 未知
+    int cpu = -1;
+    int node = -1;
+    // 退休流程：retiring 被 resize 选中，retired 不再接收任务，exited 线程已经退出
+    std::atomic<bool> retiring = {false};
+    std::atomic<bool> retired = {false};
+    std::atomic<bool> exited = {false};
+    // resize 选中后需要回到调度循环处理一次退休
+    std::atomic<bool> retireCheck = {false};
+    // 调度统计（纳秒），只由该线程写入
+    Histogram waitTime;
+    Histogram runTime;
+    std::atomic<uint64_t> switches = {0};
+    std::atomic<uint64_t> idles = {0};
+    std::atomic<uint64_t> tickles = {0};
+    std::atomic<uint64_t> syscalls = {0};
+    uint32_t statsTick = 0;
+    /**
+     *  下一个执行的任务，只由该线程访问
+     *  该线程唤醒的协程（例如 idle 中 epoll 事件触发的协程）放在这里，当前任务切出后马上执行，
+     *  数据还在缓存里；连续执行的次数受 scheduler.run_next_limit 限制，队列中的任务不会饿死
+    */
+    FiberAndThread* runNext = nullptr;
+    uint32_t runNextStreak = 0;
+    // switchTo 的目标调度器与线程，协程切出后由调度循环交给目标调度器
+    Scheduler* switchTarget = nullptr;
+    int switchThread = -1;
+    uint32_t tick = 0;
+    uint32_t seed = 2463534242u;
+    std::vector<FiberAndThread*> stealBuf;
+};
+
+// 当前线程绑定的工作线程
+static thread_local Scheduler::Worker* t_worker = nullptr;
+
+/**
+ *  一个调度类别的优先级队列
+ *  按截止时间排序的小顶堆，截止时间相同（包括都没有截止时间）时按入队顺序
+*/
+struct Scheduler::PriorityQueue{
+    struct Later{
+        bool operator()(const FiberAndThread* a, const FiberAndThread* b) const{
+            return a->deadline != b->deadline ? a->deadline > b->deadline : a->seq > b->seq;
+        }
+    };
+
+    void push(FiberAndThread* ft){
+        SpinLock::Lock lock(mutex);
+        ft->seq = seq++;
+        heap.push_back(ft);
+        std::push_heap(heap.begin(), heap.end(), Later());
+        count.store(heap.size(), std::memory_order_release);
+    }
+
+    FiberAndThread* pop(){
+        if(!count.load(std::memory_order_acquire)){
+            return nullptr;
+        }
+        SpinLock::Lock lock(mutex);
+        if(heap.empty()){
+            return nullptr;
+        }
+        std::pop_heap(heap.begin(), heap.end(), Later());
+        FiberAndThread* ft = heap.back();
+        heap.pop_back();
+        count.store(heap.size(), std::memory_order_release);
+        return ft;
+    }
+
+    SpinLock mutex;
+    std::vector<FiberAndThread*> heap;
+    uint64_t seq = 0;
+    std::atomic<size_t> count = {0};
+};
+
+Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name
+        ,const std::vector<int>& cpus)
     :m_name(name){
     COSERVER_ASSERT(threads > 0);
 
@@ -35,13 +311,66 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
         m_rootThread = -1;
     }
     m_threadCount = threads;
+
+    for(auto& i : m_priorityQueues){
+        i = new PriorityQueue;
+    }
+
+    m_cpus = cpus.empty() ? g_cpu_affinity->getValue() : cpus;
+    size_t workers = m_threadCount + (m_rootFiber ? 1 : 0);
+    m_workers.resize(std::max<size_t>(workers, g_max_threads->getValue() + (m_rootFiber ? 1 : 0)), nullptr);
+    for(size_t i = 0; i < workers; ++i){
+        newWorker();
+    }
+
+    if(!m_name.empty()){
+        m_threadsListener = g_threads->addListener([this](const std::map<std::string, uint32_t>& old_value
+                    ,const std::map<std::string, uint32_t>& new_value){
+            auto it = new_value.find(m_name);
+            if(it != new_value.end() && it->second){
+                resize(it->second);
+            }
+        });
+    }
 }
 
 Scheduler::~Scheduler(){
     COSERVER_ASSERT(m_stopping);
+    if(m_threadsListener){
+        g_threads->delListener(m_threadsListener);
+    }
     if(GetThis() == this){
         t_scheduler = nullptr;
     }
+    while(m_pinnedHead){
+        FiberAndThread* ft = m_pinnedHead;
+        m_pinnedHead = ft->next;
+        FreeTask(ft);
+    }
+    while(FiberAndThread* ft = m_injectQueue.pop()){
+        FreeTask(ft);
+    }
+    for(auto i : m_priorityQueues){
+        while(FiberAndThread* ft = i->pop()){
+            FreeTask(ft);
+        }
+        delete i;
+    }
+    for(auto i : m_workers){
+        if(!i){
+            break;
+        }
+        if(i->runNext){
+            FreeTask(i->runNext);
+        }
+        while(FiberAndThread* ft = i->popFront()){
+            FreeTask(ft);
+        }
+        while(FiberAndThread* ft = i->pinned.pop()){
+            FreeTask(ft);
+        }
+        delete i;
+    }
 }
 
 Scheduler* Scheduler::GetThis(){
@@ -52,6 +381,38 @@ Fiber* Scheduler::GetMainFiber(){
     return t_scheduler_fiber;
 }
 
+void Scheduler::switchTo(int thread){
+    COSERVER_ASSERT(Scheduler::GetThis() != nullptr);
+    if(Scheduler::GetThis() == this){
+        if(thread == -1 || thread == coServer::GetThreadId()){
+            return;
+        }
+    }
+    Fiber* cur = Fiber::GetThisRaw();
+    COSERVER_ASSERT2(cur != Scheduler::GetMainFiber(), "switchTo must be called in a fiber");
+    COSERVER_ASSERT2(!cur->isSharedStack(), "shared stack fiber is bound to thread "
+            << cur->getBoundThread());
+    // 协程切出后才交给目标调度器（见 handOff），避免目标线程取到还在运行的协程后反复放回队列
+    Worker* worker = Scheduler::GetThis()->currentWorker();
+    COSERVER_ASSERT(worker);
+    worker->switchTarget = this;
+    worker->switchThread = thread;
+    Fiber::YieldToHold();
+}
+
+void Scheduler::handOff(Worker* worker, FiberAndThread* ft){
+    Scheduler* target = worker->switchTarget;
+    worker->switchTarget = nullptr;
+    // 复用任务节点，切换不需要额外分配内存
+    ft->thread = worker->switchThread;
+    ft->priority = NORMAL;
+    ft->deadline = ~0ull;
+    ft->enqueueNs = 0;
+    if(target->scheduleTask(ft)){
+        target->tickle();
+    }
+}
+
 void Scheduler::start(){
     MutexType::Lock lock(m_mutex);
     if(!m_stopping){
@@ -59,16 +420,119 @@ void Scheduler::start(){
     }
     m_stopping = false;
     COSERVER_ASSERT(m_threads.empty());
-    m_threads.resize(m_threadCount);
-    
-    for(size_t i=0; i<m_threadCount; i++){
-        // 创建线程
-        m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this), m_name + "_" + std::to_string(i)));
-        m_threadIds.push_back(m_threads[i]->getId());
+
+    size_t count = m_workerCount;
+    for(size_t i = m_rootFiber ? 1 : 0; i < count; ++i){
+        Worker* worker = m_workers[i];
+        if(!worker->retired){
+            startWorker(worker);
+        }
     }
     lock.unlock();
 }
 
+Scheduler::Worker* Scheduler::newWorker(){
+    size_t index = m_workerCount;
+    Worker* worker = nullptr;
+    if(index < m_workers.size()){
+        worker = new Worker(g_local_queue_size->getValue());
+        worker->seed += index * 0x9E3779B9u;
+        if(!m_cpus.empty()){
+            worker->cpu = m_cpus[index % m_cpus.size()];
+            worker->node = GetNumaNodeOfCpu(worker->cpu);
+        }
+        m_workers[index] = worker;
+        m_workerCount.store(index + 1, std::memory_order_release);
+        return worker;
+    }
+    // 槽位用完，复用已经退出的工作线程；之后再指定给原线程id的任务进入暂存列表
+    for(size_t i = m_rootFiber ? 1 : 0; i < index; ++i){
+        Worker* w = m_workers[i];
+        if(w->exited && w->retired){
+            w->thread = -1;
+            w->retiring = false;
+            w->exited = false;
+            w->retired = false;
+            if(!m_cpus.empty()){
+                w->cpu = m_cpus[i % m_cpus.size()];
+                w->node = GetNumaNodeOfCpu(w->cpu);
+            }
+            return w;
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::startWorker(Worker* worker){
+    size_t index = std::find(m_workers.begin(), m_workers.end(), worker) - m_workers.begin();
+    worker->exited = false;
+    Thread::ptr thr(new Thread(std::bind(&Scheduler::runWorker, this, worker)
+                ,m_name + "_" + std::to_string(index)));
+    m_threads.push_back(thr);
+    m_threadIds.push_back(thr->getId());
+}
+
+void Scheduler::resize(size_t threads){
+    std::vector<Thread::ptr> exited;
+    {
+        MutexType::Lock lock(m_mutex);
+        // 回收已经退出的线程
+        for(auto it = m_threads.begin(); it != m_threads.end();){
+            Worker* worker = findWorker((*it)->getId());
+            if(worker && worker->exited){
+                m_threadIds.erase(std::remove(m_threadIds.begin(), m_threadIds.end(), (*it)->getId())
+                        ,m_threadIds.end());
+                exited.push_back(*it);
+                it = m_threads.erase(it);
+            }
+            else{
+                ++it;
+            }
+        }
+
+        std::vector<Worker*> active;
+        size_t count = m_workerCount;
+        for(size_t i = m_rootFiber ? 1 : 0; i < count; ++i){
+            if(!m_workers[i]->retiring){
+                active.push_back(m_workers[i]);
+            }
+        }
+        COSERVER_LOG_INFO(g_logger) << "scheduler " << m_name << " resize threads from "
+            << active.size() << " to " << threads;
+
+        for(size_t i = active.size(); i < threads; ++i){
+            Worker* worker = newWorker();
+            if(!worker){
+                COSERVER_LOG_ERROR(g_logger) << "scheduler " << m_name << " resize to " << threads
+                    << " exceeds scheduler.max_threads";
+                break;
+            }
+            if(!m_stopping){
+                startWorker(worker);
+            }
+            ++m_threadCount;
+        }
+        // 从后往前退休多余的线程
+        while(active.size() > threads){
+            Worker* worker = active.back();
+            active.pop_back();
+            worker->retiring = true;
+            --m_threadCount;
+            if(m_stopping){
+                // 没有运行中的线程，队列已经清空
+                worker->retired = true;
+                worker->exited = true;
+                continue;
+            }
+            worker->retireCheck = true;
+            tickleWorker(worker);
+        }
+    }
+    for(auto& i : exited){
+        i->join();
+    }
+}
+
 void Scheduler::stop(){
     m_autoStop = true;
     if(m_rootFiber
@@ -91,12 +555,7 @@ void Scheduler::stop(){
     }
 
     m_stopping = true;
-    for(size_t i=0; i<m_threadCount; ++i){
-        tickle();
-    }
-    if(m_rootFiber){
-        tickle();
-    }
+    wakeAll();
     if(m_rootFiber){
         // 调度器线程也加入到线程池中的情况下
         if(!stopping()){
@@ -115,88 +574,209 @@ void Scheduler::stop(){
     }
 }
 
+Scheduler::DrainResult Scheduler::drain(uint64_t timeout_ms){
+    uint64_t begin = GetCurrentMS();
+    COSERVER_LOG_INFO(g_logger) << m_name << " drain timeout=" << timeout_ms << "ms";
+    m_drainDeadline = begin + timeout_ms;
+    m_draining = true;
+    // stop 唤醒所有空闲线程，它们按截止时间重新计算等待时间
+    stop();
+
+    DrainResult result = m_drainResult;
+    result.elapsedMs = GetCurrentMS() - begin;
+    result.rejectedTasks = m_rejectedTasks;
+    std::stringstream ss;
+    result.dump(ss);
+    COSERVER_LOG_INFO(g_logger) << m_name << " drained " << ss.str();
+    return result;
+}
+
+void Scheduler::checkDrainDeadline(){
+    if(COSERVER_LIKELY(!m_draining) || m_drainExpired || GetCurrentMS() < m_drainDeadline){
+        return;
+    }
+    if(m_drainExpired.exchange(true)){
+        return;
+    }
+    onDrainDeadline(m_drainResult);
+}
+
+uint64_t Scheduler::getDrainRemainingMs() const{
+    if(COSERVER_LIKELY(!m_draining) || m_drainExpired){
+        return ~0ull;
+    }
+    uint64_t now = GetCurrentMS();
+    return now >= m_drainDeadline ? 0 : m_drainDeadline - now;
+}
+
+void Scheduler::onDrainDeadline(DrainResult& result){
+    result.timedOut = true;
+    result.pendingTasks = m_pendingTaskCount;
+    result.activeThreads = m_activeThreadCount;
+    result.externalWaits = m_externalWaits;
+    COSERVER_LOG_WARN(g_logger) << m_name << " drain deadline reached, pending_tasks="
+        << result.pendingTasks << " active_threads=" << result.activeThreads
+        << " external_waits=" << result.externalWaits;
+}
+
+std::ostream& Scheduler::DrainResult::dump(std::ostream& os) const{
+    return os << "timed_out=" << timedOut
+              << " elapsed=" << elapsedMs << "ms"
+              << " rejected=" << rejectedTasks
+              << " pending_tasks=" << pendingTasks
+              << " active_threads=" << activeThreads
+              << " external_waits=" << externalWaits
+              << " cancelled_events=" << cancelledEvents
+              << " cancelled_fds=" << cancelledFds
+              << " timers=" << timers;
+}
+
 void Scheduler::setThis(){
     t_scheduler = this;
 }
 
 void Scheduler::run() {
+    // 调度器所在线程固定使用 0 号工作线程
+    runWorker(m_workers[0]);
+}
+
+void Scheduler::runWorker(Worker* worker) {
     COSERVER_LOG_DEBUG(g_logger) << m_name << " run";
     set_hook_enable(true);
     setThis();
     if(coServer::GetThreadId() != m_rootThread) {
-        t_scheduler_fiber = Fiber::GetThis().get();
+        t_scheduler_fiber = Fiber::GetThisRaw();
     }
 
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
-    Fiber::ptr cb_fiber;
+    // 已结束的协程缓存，执行回调任务时复用，避免每个任务都重新创建协程和栈
+    // 独立栈与共享栈协程分开缓存（共享栈协程绑定在当前线程上）
+    std::vector<Fiber::ptr> dedicated_pool;
+    std::vector<Fiber::ptr> shared_pool;
+    // 协程结束后记录栈水位并放回缓存，还被其他地方引用的协程不能复用
+    auto recycle = [&](Fiber::ptr& fiber){
+        size_t stack_usage = fiber->getStackUsage();
+        if(stack_usage){
+            m_stackUsage.record(stack_usage);
+        }
+        std::vector<Fiber::ptr>& pool = fiber->isSharedStack() ? shared_pool : dedicated_pool;
+        if(fiber.use_count() == 1 && pool.size() < s_fiber_pool_size && !worker->retiring){
+            fiber->reset(nullptr);
+            pool.push_back(std::move(fiber));
+        }
+        fiber.reset();
+    };
 
-    FiberAndThread ft;
-    while(true) {
-        ft.reset();
-        bool tickle_me = false;
-        bool is_active = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            auto it = m_fibers.begin();
-            while(it != m_fibers.end()) {
-                if(it->thread != -1 && it->thread != coServer::GetThreadId()) {
-                    ++it;
-                    tickle_me = true;
-                    continue;
-                }
+    // 挂起的协程持有自己的引用：没有其他持有者时泄漏而不是在 HOLD 状态析构，只是移动引用，不增加引用计数
+    // 其他线程看到 HOLD 后才会恢复它，移动引用和归还任务节点（可能是协程自带的）都要在设置状态之前
+    auto hold = [](FiberAndThread* ft, Fiber::ptr& fiber){
+        Fiber* raw = fiber.get();
+        raw->m_holdRef = std::move(fiber);
+        FreeTask(ft);
+        raw->m_state = Fiber::HOLD;
+    };
 
-                COSERVER_ASSERT(it->fiber || it->cb);
-                if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
-                    ++it;
-                    continue;
-                }
+    if(coServer::GetThreadId() == m_rootThread) {
+        // 调用者线程不改变亲和性
+        worker->cpu = -1;
+        worker->node = -1;
+    } else if(worker->cpu >= 0 && !BindThreadToCpu(worker->cpu)) {
+        worker->cpu = -1;
+        worker->node = -1;
+    }
+    registerWorker(worker);
+    t_worker = worker;
 
-                ft = *it;
-                m_fibers.erase(it++);
-                ++m_activeThreadCount;
-                is_active = true;
-                break;
-            }
-            tickle_me |= it != m_fibers.end();
+    while(true) {
+        if(COSERVER_UNLIKELY(worker->retiring) && !worker->retired) {
+            // 退休前释放缓存的协程，共享栈协程缓存也会占用共享栈的绑定
+            dedicated_pool.clear();
+            shared_pool.clear();
+            retireWorker(worker);
+        }
+        FiberAndThread* ft = nextTask(worker);
+        if(ft && ft->fiber && ft->fiber->getState() == Fiber::EXEC) {
+            // 协程在其他线程上还没有完全切出，放回全局队列稍后再执行
+            ++m_pendingTaskCount;
+            --m_activeThreadCount;
+            pushGlobal(ft);
+            continue;
         }
 
-        if(tickle_me) {
-            tickle();
+        // 入队时被采样的任务记录等待时间和这一次的运行时间
+        uint64_t slice_begin = 0;
+        if(ft && ft->enqueueNs) {
+            slice_begin = GetCurrentNS();
+            worker->waitTime.recordLocal(slice_begin > ft->enqueueNs ? slice_begin - ft->enqueueNs : 0);
+            ft->enqueueNs = 0;
         }
 
-        if(ft.fiber && (ft.fiber->getState() != Fiber::TERM
-                        && ft.fiber->getState() != Fiber::EXCEPT)) {
-            ft.fiber->swapIn();
+        if(ft && ft->fiber && (ft->fiber->getState() != Fiber::TERM
+                        && ft->fiber->getState() != Fiber::EXCEPT)) {
+            if(ft->fiber->m_holdRef) {
+                // 已经由任务持有，释放挂起期间对自身的引用
+                ft->fiber->m_holdRef.reset();
+            }
+            ft->fiber->swapIn();
             --m_activeThreadCount;
+            endSlice(worker, slice_begin);
 
-            if(ft.fiber->getState() == Fiber::READY) {
-                schedule(ft.fiber);
-            } else if(ft.fiber->getState() != Fiber::TERM
-                    && ft.fiber->getState() != Fiber::EXCEPT) {
-                ft.fiber->m_state = Fiber::HOLD;
+            if(ft->fiber->getState() == Fiber::READY) {
+                requeue(worker, ft);
+                continue;
+            } else if(ft->fiber->getState() != Fiber::TERM
+                    && ft->fiber->getState() != Fiber::EXCEPT) {
+                if(COSERVER_UNLIKELY(worker->switchTarget)) {
+                    ft->fiber->m_state = Fiber::HOLD;
+                    handOff(worker, ft);
+                    continue;
+                }
+                hold(ft, ft->fiber);
+                continue;
+            } else {
+                // 协程自带的节点随协程析构，先归还节点再回收协程
+                Fiber::ptr fiber;
+                fiber.swap(ft->fiber);
+                FreeTask(ft);
+                recycle(fiber);
+                continue;
             }
-            ft.reset();
-        } else if(ft.cb) {
-            if(cb_fiber) {
-                cb_fiber->reset(ft.cb);
+        } else if(ft && ft->cb) {
+            std::vector<Fiber::ptr>& pool = ft->sharedStack ? shared_pool : dedicated_pool;
+            Fiber::ptr cb_fiber;
+            if(!pool.empty()) {
+                cb_fiber.swap(pool.back());
+                pool.pop_back();
+                cb_fiber->reset(std::move(ft->cb));
             } else {
-                cb_fiber.reset(new Fiber(ft.cb));
+                cb_fiber.reset(new Fiber(std::move(ft->cb), 0, false, ft->sharedStack));
             }
-            ft.reset();
             cb_fiber->swapIn();
             --m_activeThreadCount;
+            endSlice(worker, slice_begin);
             if(cb_fiber->getState() == Fiber::READY) {
-                schedule(cb_fiber);
-                cb_fiber.reset();
+                // 复用任务对象放回队列
+                ft->fiber = std::move(cb_fiber);
+                requeue(worker, ft);
+                continue;
             } else if(cb_fiber->getState() == Fiber::EXCEPT
                     || cb_fiber->getState() == Fiber::TERM) {
-                cb_fiber->reset(nullptr);
+                recycle(cb_fiber);
             } else {//if(cb_fiber->getState() != Fiber::TERM) {
-                cb_fiber->m_state = Fiber::HOLD;
-                cb_fiber.reset();
+                if(COSERVER_UNLIKELY(worker->switchTarget)) {
+                    cb_fiber->m_state = Fiber::HOLD;
+                    ft->fiber = std::move(cb_fiber);
+                    handOff(worker, ft);
+                    continue;
+                }
+                hold(ft, cb_fiber);
+                continue;
             }
+            FreeTask(ft);
         } else {
-            if(is_active) {
+            if(ft) {
+                // 已经结束的协程
+                FreeTask(ft);
                 --m_activeThreadCount;
                 continue;
             }
@@ -204,32 +784,736 @@ void Scheduler::run() {
                 COSERVER_LOG_INFO(g_logger) << "idle fiber term";
                 break;
             }
+            if(COSERVER_UNLIKELY(m_stopping) && stopping()) {
+                // 最后一个任务已经结束，唤醒停放的线程退出
+                wakeAll();
+            }
 
+            // 先标记空闲再检查专属队列，与 pushGlobal 中先入队再检查空闲标记配合，不会漏掉唤醒
+            worker->idle = true;
+            if(worker->pinnedCount) {
+                worker->idle = false;
+                continue;
+            }
             ++m_idleThreadCount;
+            if(StatsEnabled()) {
+                IncLocal(worker->idles);
+            }
             idle_fiber->swapIn();
             --m_idleThreadCount;
+            worker->idle = false;
             if(idle_fiber->getState() != Fiber::TERM
                     && idle_fiber->getState() != Fiber::EXCEPT) {
                 idle_fiber->m_state = Fiber::HOLD;
             }
         }
     }
+    t_worker = nullptr;
+    if(worker->retired) {
+        COSERVER_LOG_INFO(g_logger) << "scheduler " << m_name << " worker thread "
+            << worker->thread << " retired";
+        worker->exited = true;
+    }
+}
+
+bool Scheduler::retireWorker(Worker* worker){
+    worker->retireCheck = false;
+    if(FiberAndThread* ft = worker->runNext){
+        worker->runNext = nullptr;
+        if(ft->thread == -1){
+            if(pushGlobal(ft)){
+                tickle();
+            }
+        }
+        else{
+            // 指定了该线程，和专属队列一起处理
+            ++worker->pinnedCount;
+            worker->pinned.push(ft);
+        }
+    }
+    // 本地队列里的任务都没有指定线程，交给其他线程
+    while(FiberAndThread* ft = worker->popFront()){
+        if(pushGlobal(ft)){
+            tickle();
+        }
+    }
+    // 指定给该线程的任务改为任意线程执行，绑定在该线程共享栈上的协程只能留下
+    std::vector<FiberAndThread*> bound;
+    while(worker->pinnedCount){
+        FiberAndThread* ft = worker->pinned.pop();
+        if(!ft){
+            // 生产者还没有完成入队
+            sched_yield();
+            continue;
+        }
+        --worker->pinnedCount;
+        if(ft->fiber && ft->fiber->getBoundThread() == worker->thread){
+            bound.push_back(ft);
+            continue;
+        }
+        ft->thread = -1;
+        if(pushGlobal(ft)){
+            tickle();
+        }
+    }
+    for(auto i : bound){
+        ++worker->pinnedCount;
+        worker->pinned.push(i);
+    }
+    if(!bound.empty() || Fiber::SharedStackBindings()){
+        return false;
+    }
+
+    // 先标记退休再清空专属队列，与 pushGlobal 中先计数再检查退休标记配合，不会留下任务
+    worker->retired = true;
+    while(worker->pinnedCount){
+        FiberAndThread* ft = worker->pinned.pop();
+        if(!ft){
+            sched_yield();
+            continue;
+        }
+        --worker->pinnedCount;
+        ft->thread = -1;
+        if(pushGlobal(ft)){
+            tickle();
+        }
+    }
+    return true;
+}
+
+bool Scheduler::isRetired() const{
+    Worker* worker = currentWorker();
+    return worker && worker->retired;
+}
+
+Scheduler::FiberAndThread* Scheduler::MakeFiberTask(Fiber::ptr&& f, int thread){
+    if(COSERVER_UNLIKELY(!f)){
+        return new FiberAndThread(std::move(f), thread);
+    }
+    FiberAndThread* ft = (FiberAndThread*)f->m_taskNode.load(std::memory_order_acquire);
+    if(COSERVER_UNLIKELY(!ft)){
+        // 第一次唤醒时创建，多个线程同时创建时只保留一个
+        FiberAndThread* node = new FiberAndThread();
+        node->embedded = true;
+        void* expected = nullptr;
+        if(f->m_taskNode.compare_exchange_strong(expected, node, std::memory_order_acq_rel)){
+            ft = node;
+        }
+        else{
+            delete node;
+            ft = (FiberAndThread*)expected;
+        }
+    }
+    if(COSERVER_UNLIKELY(ft->inUse.exchange(true, std::memory_order_acquire))){
+        // 同一个协程被重复调度，节点还在使用中
+        return new FiberAndThread(std::move(f), thread);
+    }
+    ft->reset();
+    ft->thread = thread;
+    ft->fiber = std::move(f);
+    ft->next.store(nullptr, std::memory_order_relaxed);
+    return ft;
+}
+
+void Scheduler::FreeTask(FiberAndThread* ft){
+    if(!ft->embedded){
+        delete ft;
+        return;
+    }
+    // 先取出协程再释放节点，协程析构（释放节点）发生在节点归还之后
+    Fiber::ptr fiber;
+    fiber.swap(ft->fiber);
+    ft->cb = nullptr;
+    ft->inUse.store(false, std::memory_order_release);
+}
+
+void Scheduler::DeleteTaskNode(void* node){
+    delete (FiberAndThread*)node;
+}
+
+bool Scheduler::scheduleTask(FiberAndThread* ft){
+    if(!ft->fiber && !ft->cb){
+        FreeTask(ft);
+        return false;
+    }
+    if(COSERVER_UNLIKELY(m_draining.load(std::memory_order_relaxed)) && !ft->fiber && t_scheduler != this){
+        // drain 后不再接受外部提交的新任务，已有协程的重新调度仍然接受
+        ++m_rejectedTasks;
+        COSERVER_LOG_WARN(g_logger) << m_name << " is draining, reject new task";
+        FreeTask(ft);
+        return false;
+    }
+    // 共享栈协程只能在绑定的线程上恢复
+    if(ft->fiber && ft->thread == -1){
+        ft->thread = ft->fiber->getBoundThread();
+    }
+    Worker* worker = t_scheduler == this ? t_worker : nullptr;
+    if(StatsSampled(worker ? worker->statsTick : t_stats_tick)){
+        ft->enqueueNs = GetCurrentNS();
+    }
+    ++m_pendingTaskCount;
+    if(worker && ft->fiber && (ft->thread == -1 || ft->thread == worker->thread)
+            && !ft->isPrioritized() && !worker->retiring && s_run_next_limit){
+        // 当前线程唤醒的协程放入 runNext，原来的任务挤到普通队列
+        FiberAndThread* prev = worker->runNext;
+        worker->runNext = ft;
+        if(!prev){
+            return false;
+        }
+        ft = prev;
+    }
+    if(ft->thread == -1 && !ft->isPrioritized() && worker && !worker->retiring && worker->pushBack(ft)){
+        return hasIdleThreads();
+    }
+    return pushGlobal(ft);
+}
+
+void Scheduler::requeue(Worker* worker, FiberAndThread* ft){
+    ft->cb = nullptr;
+    if(StatsSampled(worker->statsTick)){
+        ft->enqueueNs = GetCurrentNS();
+    }
+    if(ft->thread == -1){
+        ft->thread = ft->fiber->getBoundThread();
+    }
+    ++m_pendingTaskCount;
+    if(ft->thread == -1 && !ft->isPrioritized() && !worker->retiring && worker->pushBack(ft)){
+        if(hasIdleThreads()){
+            tickle();
+        }
+        return;
+    }
+    if(pushGlobal(ft)){
+        tickle();
+    }
+}
+
+bool Scheduler::pushGlobal(FiberAndThread* ft){
+    if(ft->thread == -1 && ft->isPrioritized()){
+        m_priorityQueues[ft->priority]->push(ft);
+        return true;
+    }
+    if(ft->thread == -1){
+        ++m_injectTaskCount;
+        m_injectQueue.push(ft);
+        return true;
+    }
+    Worker* worker = findWorker(ft->thread);
+    if(!worker){
+        MutexType::Lock lock(m_mutex);
+        // 加锁后再查一次，与 registerWorker 互斥
+        worker = findWorker(ft->thread);
+        if(!worker){
+            ft->next = nullptr;
+            if(m_pinnedTail){
+                m_pinnedTail->next = ft;
+            }
+            else{
+                m_pinnedHead = ft;
+            }
+            m_pinnedTail = ft;
+            return false;
+        }
+    }
+    ++worker->pinnedCount;
+    if(COSERVER_UNLIKELY(worker->retired)){
+        // 目标线程已经退休，改为任意线程执行
+        --worker->pinnedCount;
+        ft->thread = -1;
+        return pushGlobal(ft);
+    }
+    worker->pinned.push(ft);
+    if(worker->idle){
+        tickleWorker(worker);
+    }
+    return false;
+}
+
+Scheduler::Worker* Scheduler::findWorker(int thread) const{
+    size_t count = m_workerCount.load(std::memory_order_acquire);
+    for(size_t i = 0; i < count; ++i){
+        if(m_workers[i]->thread.load(std::memory_order_acquire) == thread){
+            return m_workers[i];
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::registerWorker(Worker* worker){
+    MutexType::Lock lock(m_mutex);
+    worker->thread = coServer::GetThreadId();
+    FiberAndThread* prev = nullptr;
+    FiberAndThread* task = m_pinnedHead;
+    while(task){
+        FiberAndThread* next = task->next;
+        if(task->thread == worker->thread){
+            if(prev){
+                prev->next.store(next);
+            }
+            else{
+                m_pinnedHead = next;
+            }
+            if(m_pinnedTail == task){
+                m_pinnedTail = prev;
+            }
+            ++worker->pinnedCount;
+            worker->pinned.push(task);
+        }
+        else{
+            prev = task;
+        }
+        task = next;
+    }
+}
+
+Scheduler::FiberAndThread* Scheduler::nextTask(Worker* worker){
+    FiberAndThread* ft = nullptr;
+    if(COSERVER_UNLIKELY(worker->retiring)){
+        // 退休中的线程只执行绑定在它上面的协程
+        ft = takePinned(worker);
+        if(ft){
+            ++m_activeThreadCount;
+            --m_pendingTaskCount;
+        }
+        return ft;
+    }
+    ++worker->tick;
+    // 防饿死：每隔一段时间先取低类别的任务
+    uint32_t interval = s_starvation_interval;
+    bool low_first = interval && worker->tick % interval == 0;
+    if(low_first){
+        ft = takePriority(BACKGROUND);
+    }
+    else{
+        ft = takePriority(HIGH);
+    }
+    bool run_next = false;
+    if(!ft && worker->runNext){
+        if(worker->runNextStreak < s_run_next_limit){
+            ft = worker->runNext;
+            worker->runNext = nullptr;
+            run_next = true;
+        }
+    }
+    if(!ft){
+        ft = takePriority(NORMAL);
+    }
+    if(!ft && worker->tick % s_global_check_interval == 0){
+        ft = takePinned(worker);
+        if(!ft){
+            ft = takeInject(worker);
+        }
+    }
+    if(!ft){
+        ft = worker->popFront();
+    }
+    if(!ft){
+        ft = takePinned(worker);
+    }
+    if(!ft){
+        ft = takeInject(worker);
+    }
+    if(!ft){
+        ft = steal(worker);
+    }
+    if(!ft){
+        ft = takePriority(low_first ? HIGH : BACKGROUND);
+    }
+    if(!ft && worker->runNext){
+        // 连续次数已经用完但没有其他任务
+        ft = worker->runNext;
+        worker->runNext = nullptr;
+    }
+    worker->runNextStreak = run_next ? worker->runNextStreak + 1 : 0;
+    if(ft){
+        // 先增加活跃线程数再减少待执行任务数，stopping 不会在两者之间看到全为 0
+        ++m_activeThreadCount;
+        --m_pendingTaskCount;
+    }
+    return ft;
+}
+
+Scheduler::FiberAndThread* Scheduler::takePriority(int priority){
+    return m_priorityQueues[priority]->pop();
+}
+
+Scheduler::FiberAndThread* Scheduler::takePinned(Worker* worker){
+    if(!worker->pinnedCount.load(std::memory_order_relaxed)){
+        return nullptr;
+    }
+    FiberAndThread* ft = worker->pinned.pop();
+    if(!ft){
+        // 生产者还没有完成入队
+        return nullptr;
+    }
+    --worker->pinnedCount;
+    if(ft->fiber && ft->fiber->getState() == Fiber::EXEC){
+        // 协程还在其他线程上执行，放回队尾
+        ++worker->pinnedCount;
+        worker->pinned.push(ft);
+        return nullptr;
+    }
+    return ft;
+}
+
+Scheduler::FiberAndThread* Scheduler::takeInject(Worker* worker){
+    if(!m_injectTaskCount.load(std::memory_order_relaxed)
+            || m_injectPopping.exchange(true, std::memory_order_acquire)){
+        return nullptr;
+    }
+    // 顺带取一批任务到本地队列，最多取注入队列的平均份额
+    size_t batch = std::min(m_injectTaskCount / m_workerCount
+                        ,worker->tasks.size() / 2);
+    // 还在其他线程上执行的协程，取完后重新入队
+    std::vector<FiberAndThread*>& skipped = worker->stealBuf;
+    skipped.clear();
+    FiberAndThread* ft = nullptr;
+    while(FiberAndThread* task = m_injectQueue.pop()){
+        --m_injectTaskCount;
+        if(task->fiber && task->fiber->getState() == Fiber::EXEC){
+            skipped.push_back(task);
+        } else if(!ft){
+            ft = task;
+        } else if(!worker->pushBack(task)){
+            // 本地队列已满
+            skipped.push_back(task);
+            break;
+        } else {
+            --batch;
+        }
+        if(ft && !batch){
+            break;
+        }
+    }
+    m_injectPopping.store(false, std::memory_order_release);
+
+    for(auto i : skipped){
+        ++m_injectTaskCount;
+        m_injectQueue.push(i);
+    }
+    if(m_injectTaskCount.load(std::memory_order_relaxed)){
+        tickle();
+    }
+    return ft;
+}
+
+Scheduler::FiberAndThread* Scheduler::steal(Worker* worker){
+    size_t n = m_workerCount.load(std::memory_order_acquire);
+    if(n <= 1){
+        return nullptr;
+    }
+    size_t start = worker->random() % n;
+    // 第一轮只窃取同一节点上的线程，节点未知时只有一轮
+    for(int round = worker->node >= 0 ? 0 : 1; round < 2; ++round){
+        for(size_t i = 0; i < n; ++i){
+            Worker* victim = m_workers[(start + i) % n];
+            if(victim == worker || !victim->size()){
+                continue;
+            }
+            if(worker->node >= 0 && (victim->node == worker->node) != (round == 0)){
+                continue;
+            }
+            std::vector<FiberAndThread*>& buf = worker->stealBuf;
+            buf.clear();
+            if(!victim->stealHalf(buf)){
+                continue;
+            }
+            for(size_t j = 1; j < buf.size(); ++j){
+                if(!worker->pushBack(buf[j])){
+                    pushGlobal(buf[j]);
+                }
+            }
+            return buf[0];
+        }
+    }
+    return nullptr;
+}
+
+SchedulerSwitcher::SchedulerSwitcher(Scheduler* target)
+    :m_caller(Scheduler::GetThis()){
+    if(target){
+        target->switchTo();
+    }
+}
+
+SchedulerSwitcher::~SchedulerSwitcher(){
+    if(m_caller){
+        m_caller->switchTo();
+    }
+}
+
+std::ostream& Scheduler::dumpStackUsage(std::ostream& os) const{
+    os << "[Scheduler name=" << m_name << " stack usage] ";
+    return m_stackUsage.dump(os, "B");
+}
+
+Scheduler::Worker* Scheduler::currentWorker() const{
+    return t_scheduler == this ? t_worker : nullptr;
+}
+
+bool Scheduler::hasRunnableTask() const{
+    Worker* worker = currentWorker();
+    if(m_injectTaskCount || (worker && worker->pinnedCount)){
+        return true;
+    }
+    for(auto i : m_priorityQueues){
+        if(i->count){
+            return true;
+        }
+    }
+    if(worker && worker->runNext){
+        return true;
+    }
+    if(worker && worker->retiring && !worker->retired
+            && (worker->retireCheck || !Fiber::SharedStackBindings())){
+        // 需要回到调度循环继续退休
+        return true;
+    }
+    size_t count = m_workerCount.load(std::memory_order_acquire);
+    for(size_t i = 0; i < count; ++i){
+        if(m_workers[i]->size()){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Scheduler::parkIdle(uint64_t timeout_ms){
+    Worker* worker = currentWorker();
+    if(!worker){
+        return false;
+    }
+    {
+        SpinLock::Lock lock(m_idleLock);
+        worker->parked = true;
+        m_parkedWorkers.push_back(worker);
+        ++m_parkedCount;
+    }
+    // 先入栈再检查，与提交任务时先入队再唤醒配合，不会漏掉唤醒
+    bool woken = false;
+    if(!hasRunnableTask() && !(m_stopping && stopping())){
+        woken = worker->parker.park(timeout_ms);
+    }
+    if(!woken){
+        SpinLock::Lock lock(m_idleLock);
+        // 已经被唤醒方取出时，它的 unpark 留到下一次 park 时消费
+        if(worker->parked){
+            worker->parked = false;
+            m_parkedWorkers.erase(std::find(m_parkedWorkers.begin(), m_parkedWorkers.end(), worker));
+            --m_parkedCount;
+        }
+    }
+    else if(!hasRunnableTask()){
+        ++m_spuriousWakeups;
+    }
+    return woken;
+}
+
+bool Scheduler::wakeOne(){
+    if(!m_parkedCount){
+        return false;
+    }
+    Worker* worker = nullptr;
+    {
+        SpinLock::Lock lock(m_idleLock);
+        if(m_parkedWorkers.empty()){
+            return false;
+        }
+        worker = m_parkedWorkers.back();
+        m_parkedWorkers.pop_back();
+        worker->parked = false;
+        --m_parkedCount;
+    }
+    ++m_wakeups;
+    worker->parker.unpark();
+    return true;
+}
+
+bool Scheduler::wakeWorker(Worker* worker){
+    {
+        SpinLock::Lock lock(m_idleLock);
+        if(!worker->parked){
+            return false;
+        }
+        worker->parked = false;
+        m_parkedWorkers.erase(std::find(m_parkedWorkers.begin(), m_parkedWorkers.end(), worker));
+        --m_parkedCount;
+    }
+    ++m_wakeups;
+    worker->parker.unpark();
+    return true;
+}
+
+void Scheduler::wakeAll(){
+    std::vector<Worker*> workers;
+    {
+        SpinLock::Lock lock(m_idleLock);
+        workers.swap(m_parkedWorkers);
+        for(auto i : workers){
+            i->parked = false;
+        }
+        m_parkedCount = 0;
+    }
+    for(auto i : workers){
+        ++m_wakeups;
+        i->parker.unpark();
+    }
+    // 没有停放、但在 idle 中等待的线程（例如 epoll_wait）
+    tickle();
 }
 
 void Scheduler::tickle(){
-    COSERVER_LOG_INFO(g_logger) << "tickle";
+    recordTickle();
+    wakeOne();
+}
+
+void Scheduler::tickleWorker(Worker* worker){
+    recordTickle();
+    wakeWorker(worker);
+}
+
+void Scheduler::recordTickle(){
+    if(!StatsEnabled()){
+        return;
+    }
+    Worker* worker = currentWorker();
+    if(worker){
+        IncLocal(worker->tickles);
+    }
+    else{
+        ++m_externalTickles;
+    }
+}
+
+void Scheduler::recordSyscall(){
+    if(!StatsEnabled()){
+        return;
+    }
+    Worker* worker = currentWorker();
+    if(worker){
+        IncLocal(worker->syscalls);
+    }
+}
+
+void Scheduler::endSlice(Worker* worker, uint64_t begin){
+    if(!StatsEnabled()){
+        return;
+    }
+    IncLocal(worker->switches);
+    if(begin){
+        worker->runTime.recordLocal(GetCurrentNS() - begin);
+    }
+}
+
+void Scheduler::getStats(Stats& stats) const{
+    stats.pendingTasks = m_pendingTaskCount;
+    stats.injectQueue = m_injectTaskCount;
+    stats.priorityQueue = 0;
+    for(auto i : m_priorityQueues){
+        stats.priorityQueue += i->count;
+    }
+    stats.activeThreads = m_activeThreadCount;
+    stats.idleThreads = m_idleThreadCount;
+    stats.externalTickles = m_externalTickles;
+    stats.waitTime.reset();
+    stats.runTime.reset();
+    stats.threads.clear();
+
+    size_t count = m_workerCount.load(std::memory_order_acquire);
+    for(size_t i = 0; i < count; ++i){
+        Worker* worker = m_workers[i];
+        if(worker->exited){
+            continue;
+        }
+        Stats::ThreadStats ts;
+        ts.thread = worker->thread;
+        ts.localQueue = worker->size();
+        ts.pinnedQueue = worker->pinnedCount;
+        ts.switches = worker->switches;
+        ts.idles = worker->idles;
+        ts.tickles = worker->tickles;
+        ts.syscalls = worker->syscalls;
+        ts.waitP50 = worker->waitTime.percentile(0.5);
+        ts.waitP99 = worker->waitTime.percentile(0.99);
+        ts.runP50 = worker->runTime.percentile(0.5);
+        ts.runP99 = worker->runTime.percentile(0.99);
+        stats.threads.push_back(ts);
+        stats.waitTime.merge(worker->waitTime);
+        stats.runTime.merge(worker->runTime);
+    }
+}
+
+void Scheduler::resetStats(){
+    size_t count = m_workerCount.load(std::memory_order_acquire);
+    for(size_t i = 0; i < count; ++i){
+        Worker* worker = m_workers[i];
+        worker->waitTime.reset();
+        worker->runTime.reset();
+        worker->switches = 0;
+        worker->idles = 0;
+        worker->tickles = 0;
+        worker->syscalls = 0;
+    }
+    m_externalTickles = 0;
+}
+
+std::ostream& Scheduler::Stats::dump(std::ostream& os) const{
+    os << "pending=" << pendingTasks
+       << " inject=" << injectQueue
+       << " priority=" << priorityQueue
+       << " active=" << activeThreads
+       << " idle=" << idleThreads
+       << " external_tickles=" << externalTickles << std::endl;
+    for(auto& i : threads){
+        os << "    thread=" << i.thread
+           << " local=" << i.localQueue
+           << " pinned=" << i.pinnedQueue
+           << " switches=" << i.switches
+           << " idles=" << i.idles
+           << " tickles=" << i.tickles
+           << " syscalls=" << i.syscalls
+           << " wait_p50=" << i.waitP50 << "ns"
+           << " wait_p99=" << i.waitP99 << "ns"
+           << " run_p50=" << i.runP50 << "ns"
+           << " run_p99=" << i.runP99 << "ns" << std::endl;
+    }
+    os << "wait ";
+    waitTime.dump(os, "ns");
+    os << "run ";
+    return runTime.dump(os, "ns");
 }
 
 bool Scheduler::stopping(){
-    MutexType::Lock lock(m_mutex);
-    return m_autoStop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+    return m_autoStop && m_stopping && m_pendingTaskCount == 0 && m_activeThreadCount == 0
+        && m_externalWaits == 0;
 }
 
 void Scheduler::idle(){
-    COSERVER_LOG_INFO(g_logger) << "idle";
-    // 当协程调度器没有停止时，将当前正在执行的协程设为HOLD状态
-    while(!stopping()){
-        coServer::Fiber::YieldToHold();
+    COSERVER_LOG_DEBUG(g_logger) << "idle";
+    // 停放的超时时间，只是兜底，正常情况下由 tickle / stop 唤醒
+    static const uint64_t MAX_PARK_MS = 3000;
+    while(!stopping() && !isRetired()){
+        checkDrainDeadline();
+        // 先自旋一小段时间，任务很快到来时不需要经过 futex 睡眠和唤醒
+        uint32_t spin_us = s_idle_spin_us;
+        bool found = hasRunnableTask();
+        if(!found && spin_us){
+            uint64_t deadline = GetCurrentUS() + spin_us;
+            do{
+                for(int i = 0; i < 64; ++i){
+                    CpuRelax();
+                }
+                found = hasRunnableTask();
+            }while(!found && !stopping() && GetCurrentUS() < deadline);
+        }
+        if(!found){
+            parkIdle(std::min(MAX_PARK_MS, getDrainRemainingMs()));
+            if(!hasRunnableTask()){
+                continue;
+            }
+        }
+        // 回到 run 中取任务
+        Fiber::GetThisRaw()->swapOut();
     }
 }
 
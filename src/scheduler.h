@@ -7,7 +7,11 @@
 #include <iostream>
 
 #include "fiber.h"
+#include "histogram.h"
+#include "mpsc_queue.h"
+#include "small_callable.h"
 #include "thread.h"
+#include "util.h"
 
 namespace coServer{
 
@@ -17,13 +21,27 @@ public:
     typedef std::shared_ptr<Scheduler> ptr;
     typedef Mutex MutexType;
 
+    // 工作线程及其本地任务队列，定义在 scheduler.cc 中
+    struct Worker;
+
+    // 调度类别，数值越小越先执行
+    enum Priority{
+        HIGH = 0,
+        NORMAL = 1,
+        BACKGROUND = 2,
+        PRIORITY_COUNT
+    };
+
     /**
      * 调度器构造函数
      * threads：线程数
      * use_caller:调度器协程是否加入协程池
      * name：协程池命名
+     * cpus：第 N 个线程绑定到 cpus[N % cpus.size()]，为空时使用 scheduler.cpu_affinity 配置，
+     *       都为空时不绑定；调用者线程（use_caller）不绑定
     */
-    Scheduler(size_t threads=1, bool use_caller=true, const std::string& name="");
+    Scheduler(size_t threads=1, bool use_caller=true, const std::string& name=""
+            ,const std::vector<int>& cpus = std::vector<int>());
 
     virtual ~Scheduler();
 
@@ -41,15 +59,99 @@ public:
     // 停止协程调度器
     void stop();
 
-    // 
+    // drain 的结果
+    struct DrainResult{
+        // 是否到达截止时间，为 false 时下面的快照都为 0
+        bool timedOut = false;
+        // 从开始 drain 到停止的耗时（毫秒）
+        uint64_t elapsedMs = 0;
+        // drain 期间拒绝的新任务数
+        uint64_t rejectedTasks = 0;
+        // 到达截止时间时排队的任务、正在执行任务的线程、等待调度器之外唤醒的协程
+        size_t pendingTasks = 0;
+        size_t activeThreads = 0;
+        size_t externalWaits = 0;
+        // 到达截止时间时取消的 IO 事件、涉及的句柄以及剩余的定时器（IOManager）
+        size_t cancelledEvents = 0;
+        size_t cancelledFds = 0;
+        size_t timers = 0;
+
+        std::ostream& dump(std::ostream& os) const;
+    };
+
+    /**
+     *  优雅停止：不再接受调度器之外的线程提交的新函数任务（协程的重新调度不受影响），
+     *  等待已有的任务执行完、挂起的协程结束后停止
+     *  timeout_ms 后还没有停止时，IOManager 取消所有等待中的 IO 事件：挂起在 hook IO 上的协程
+     *  返回 -1、errno 为 ECANCELED，之后再等待 IO 的协程也立即返回 ECANCELED
+     *  截止时间由空闲线程检查，线程都一直忙碌时要等到有线程空闲；调用线程的要求同 stop
+     *  返回截止时间到达时还没有完成的工作
+    */
+    DrainResult drain(uint64_t timeout_ms);
+
+    // 是否正在 drain
+    bool isDraining() const {return m_draining;}
+
+    // drain 的截止时间是否已到，到了之后 IO 等待都返回 ECANCELED
+    bool isDrainExpired() const {return m_drainExpired;}
+
+    /**
+     *  调整调度器创建的线程数（不包括 use_caller 时的调用者线程），运行中也可以调用
+     *  增加时直接启动新线程；减少时选中的线程先把本地队列和指定给它的任务交给其他线程，
+     *  等绑定在它上面的共享栈协程都结束后再退出
+     *  配置 scheduler.threads（调度器名 -> 线程数）变化时会对同名调度器调用
+    */
+    void resize(size_t threads);
+
+    // 调度器创建的线程数（不包括调用者线程）
+    size_t getThreadCount() const {return m_threadCount;}
+
+    /**
+     *  当前协程将要挂起，等待调度器之外的线程（例如卸载线程池）重新调度它
+     *  在协程中挂起前后成对调用，期间调度器不会因为任务都已完成而停止
+    */
+    void beginExternalWait() {++m_externalWaits;}
+    void endExternalWait() {--m_externalWaits;}
+
+    /**
+     *  在协程中调用，把当前协程挂起并放到本调度器上恢复执行（例如从网络 IOManager 切到计算调度器）
+     *  thread : 指定执行的线程id，-1 表示任意线程
+     *  已经在本调度器上（并且满足线程要求）时直接返回
+     *  共享栈协程绑定在所在线程上，不能切换
+    */
+    void switchTo(int thread = -1);
+
+    /**
+     * 添加调度任务
+     * fc : 协程或函数，函数对象直接构造在任务节点的 SmallCallable 中；
+     *      传入 Fiber::ptr* / SmallCallable* / std::function<void()>* 时取走其中的对象
+     * thread : 指定执行的线程id，-1表示任意线程
+     * shared_stack : 函数任务是否运行在共享栈协程上
+    */
     template<class FiberOrCb>
-    void schedule(FiberOrCb fc, int thread = -1){
-        bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
+    void schedule(FiberOrCb&& fc, int thread = -1, bool shared_stack = false){
+        FiberAndThread* ft = MakeTask(std::forward<FiberOrCb>(fc), thread);
+        ft->sharedStack = shared_stack;
+        if(scheduleTask(ft)){
+            tickle();
         }
-        if(need_tickle){
+    }
+
+    /**
+     * 按调度类别添加任务（不能指定线程）
+     * priority : HIGH 先于 NORMAL 先于 BACKGROUND 执行；每隔 scheduler.starvation_interval 次调度
+     *            反过来先取低类别的任务，高类别任务一直很多时低类别任务也不会饿死
+     * deadline_ms : 截止时间（距现在的毫秒数），同一类别内截止时间早的先执行（EDF），0 表示没有截止时间
+    */
+    template<class FiberOrCb>
+    void schedule(FiberOrCb&& fc, Priority priority, uint64_t deadline_ms = 0, bool shared_stack = false){
+        FiberAndThread* ft = MakeTask(std::forward<FiberOrCb>(fc), -1);
+        ft->sharedStack = shared_stack;
+        ft->priority = priority;
+        if(deadline_ms){
+            ft->deadline = GetCurrentMS() + deadline_ms;
+        }
+        if(scheduleTask(ft)){
             tickle();
         }
     }
@@ -57,22 +159,87 @@ public:
     template<class InputIterator>
     void schedule(InputIterator begin, InputIterator end){
         bool need_tickle = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            while(begin != end){
-                need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
-                ++begin;
-            }
+        while(begin != end){
+            need_tickle = scheduleTask(MakeTask(&*begin, -1)) || need_tickle;
+            ++begin;
         }
         if(need_tickle){
             tickle();
         }
     }
 
+    /**
+     *  输出该调度器上已结束协程的栈使用水位分布
+     *  需要开启 fiber.stack_watermark
+    */
+    std::ostream& dumpStackUsage(std::ostream& os) const;
+
+    /**
+     *  停放的线程被唤醒的次数，以及其中唤醒后没有任务可执行（伪唤醒）的次数
+     *  两次采样相减除以间隔即为每秒的唤醒 / 伪唤醒次数
+    */
+    uint64_t getWakeups() const {return m_wakeups;}
+    uint64_t getSpuriousWakeups() const {return m_spuriousWakeups;}
+
+    /**
+     *  调度统计快照，由 getStats 填充
+     *  时间单位为纳秒；waitTime 为任务从入队到开始执行的延迟，runTime 为每次切入到切出的运行时间，
+     *  两者按 scheduler.stats_sample 抽样，计数不抽样
+     *  需要开启 scheduler.stats（默认关闭，开启后每次协程切换都要多做计数），编译时定义 COSERVER_DISABLE_SCHEDULER_STATS 则只有队列长度
+    */
+    struct Stats : Noncopyable{
+        struct ThreadStats{
+            int thread = -1;
+            // 本地队列与指定给该线程的任务数
+            size_t localQueue = 0;
+            size_t pinnedQueue = 0;
+            // 切入任务协程、进入 idle、发出 tickle 的次数
+            uint64_t switches = 0;
+            uint64_t idles = 0;
+            uint64_t tickles = 0;
+            // hook 与 IOManager 发起的 IO 相关系统调用次数
+            uint64_t syscalls = 0;
+            uint64_t waitP50 = 0;
+            uint64_t waitP99 = 0;
+            uint64_t runP50 = 0;
+            uint64_t runP99 = 0;
+        };
+
+        size_t pendingTasks = 0;
+        size_t injectQueue = 0;
+        size_t priorityQueue = 0;
+        size_t activeThreads = 0;
+        size_t idleThreads = 0;
+        // 非调度线程发出的 tickle
+        uint64_t externalTickles = 0;
+        // 所有线程合并后的直方图
+        Histogram waitTime;
+        Histogram runTime;
+        std::vector<ThreadStats> threads;
+
+        std::ostream& dump(std::ostream& os) const;
+    };
+
+    // 获取统计快照，各线程的统计各自独立，快照不是严格一致的
+    void getStats(Stats& stats) const;
+
+    // 清空统计，与工作线程的记录并发时可能丢失少量计数
+    void resetStats();
+
+    // 记录当前工作线程发起的一次 IO 系统调用（read / epoll_wait / io_uring_enter 等）
+    void recordSyscall();
+
 protected:
 
+    // 有新的可执行任务，唤醒一个空闲线程
     virtual void tickle();
 
+    // 有指定给 worker 线程的任务，只唤醒该线程
+    virtual void tickleWorker(Worker* worker);
+
+    // tickle / tickleWorker 的实现中调用，记录 tickle 次数
+    void recordTickle();
+
     void run();
     
     virtual bool stopping();
@@ -83,43 +250,91 @@ protected:
 
     bool hasIdleThreads(){return m_idleThreadCount > 0;}
 
-private:
-    // 无锁调度任务：将任务对象添加到任务列表中
-    template<class FiberOrCb>
-    bool scheduleNoLock(FiberOrCb fc, int thread){
-        bool need_tickle = m_fibers.empty();
-        FiberAndThread ft(fc, thread);
-        if(ft.fiber || ft.cb){
-            m_fibers.push_back(ft);
-        }
-        return need_tickle;
-    }
+    // 当前线程是否已经退休，idle 看到后直接返回，线程随后退出
+    bool isRetired() const;
+
+    // 当前线程绑定的工作线程，不是该调度器的线程时返回 nullptr
+    Worker* currentWorker() const;
+
+    // 当前线程是否有任务可以执行（本地、注入队列、指定给自己的任务以及可以窃取的任务）
+    bool hasRunnableTask() const;
+
+    /**
+     *  停放当前线程，直到被 wakeOne / wakeWorker / wakeAll 唤醒或超时
+     *  停放前放入空闲线程栈并再检查一次任务，有任务或调度器正在停止时直接返回
+     *  返回是否被唤醒
+    */
+    bool parkIdle(uint64_t timeout_ms);
+
+    // 唤醒最近停放的一个线程（LIFO，缓存更热），没有停放的线程时返回 false
+    bool wakeOne();
+
+    // 唤醒指定的线程，它没有停放时返回 false
+    bool wakeWorker(Worker* worker);
+
+    // 唤醒所有停放的线程，调度器停止时使用
+    void wakeAll();
+
+    // 空闲线程调用，drain 的截止时间已到时执行一次 onDrainDeadline
+    void checkDrainDeadline();
+
+    // 距离 drain 截止时间的毫秒数，没有在 drain 或者已经过了截止时间时返回 ~0ull
+    uint64_t getDrainRemainingMs() const;
+
+    // drain 到达截止时间时调用一次，记录未完成的工作；子类在这里取消挂起的协程
+    virtual void onDrainDeadline(DrainResult& result);
 
 private:
+    friend class Fiber;
     // 任务类，将协程与执行协程的线程封装在一起
     struct FiberAndThread{
         // 任务可以是协程对象
         Fiber::ptr fiber;
         // 任务可以是函数对象
-        std::function<void()> cb;
+        SmallCallable cb;
         int thread;
+        // 函数任务是否使用共享栈协程执行
+        bool sharedStack = false;
+        // 调度类别
+        uint8_t priority = NORMAL;
+        // 截止时间（绝对时间，毫秒），~0ull 表示没有截止时间
+        uint64_t deadline = ~0ull;
+        // 进入优先级队列的顺序，截止时间相同时先进先出
+        uint64_t seq = 0;
+        // 入队时间（单调时钟，纳秒），没有被统计采样时为 0
+        uint64_t enqueueNs = 0;
+        // 所在链表（注入队列或指定线程的任务链表）中的下一个任务
+        std::atomic<FiberAndThread*> next = {nullptr};
+        // 协程自带的节点（Fiber::m_taskNode），用完后放回协程而不是 delete
+        bool embedded = false;
+        // 协程自带的节点是否正在队列中或正在执行
+        std::atomic<bool> inUse = {false};
 
         FiberAndThread(Fiber::ptr* f, int thr)
             :thread(thr) {
             fiber.swap(*f);
         }
 
-        FiberAndThread(Fiber::ptr f, int thr)
+        FiberAndThread(const Fiber::ptr& f, int thr)
             :fiber(f), thread(thr){}
-        
-        FiberAndThread(std::function<void()> f, int thr)
-            :cb(f), thread(thr){}
+
+        FiberAndThread(Fiber::ptr&& f, int thr)
+            :fiber(std::move(f)), thread(thr){}
+
+        FiberAndThread(SmallCallable* f, int thr)
+            :cb(std::move(*f)), thread(thr){}
 
         FiberAndThread(std::function<void()>* f, int thr)
-            :thread(thr){
-            cb.swap(*f);
+            :cb(std::move(*f)), thread(thr){
+            *f = nullptr;
         }
 
+        // 函数对象直接构造在 cb 中
+        template<class F, class = typename std::enable_if<
+            std::is_constructible<SmallCallable, F&&>::value>::type>
+        FiberAndThread(F&& f, int thr)
+            :cb(std::forward<F>(f)), thread(thr){}
+
         FiberAndThread()
             :thread(-1){}
 
@@ -128,18 +343,159 @@ private:
             fiber = nullptr;
             cb = nullptr;
             thread = -1;
+            sharedStack = false;
+            priority = NORMAL;
+            deadline = ~0ull;
+            enqueueNs = 0;
         }
+
+        // 是否需要进入优先级队列（NORMAL 且没有截止时间的任务走普通队列）
+        bool isPrioritized() const {return priority != NORMAL || deadline != ~0ull;}
     };
 
+    /**
+     *  创建任务节点
+     *  唤醒协程时使用协程自带的节点（第一次唤醒时创建，之后复用），入队不申请内存；
+     *  同一个协程已经在队列中时（重复调度）才另外申请
+    */
+    static FiberAndThread* MakeFiberTask(Fiber::ptr&& f, int thread);
+
+    static FiberAndThread* MakeTask(Fiber::ptr* f, int thread){
+        Fiber::ptr fiber;
+        fiber.swap(*f);
+        return MakeFiberTask(std::move(fiber), thread);
+    }
+
+    static FiberAndThread* MakeTask(const Fiber::ptr& f, int thread){
+        return MakeFiberTask(Fiber::ptr(f), thread);
+    }
+
+    static FiberAndThread* MakeTask(Fiber::ptr&& f, int thread){
+        return MakeFiberTask(std::move(f), thread);
+    }
+
+    template<class F, class = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Fiber::ptr>::value
+        && !std::is_same<typename std::decay<F>::type, Fiber::ptr*>::value>::type>
+    static FiberAndThread* MakeTask(F&& f, int thread){
+        return new FiberAndThread(std::forward<F>(f), thread);
+    }
+
+    // 释放任务节点，协程自带的节点放回协程
+    static void FreeTask(FiberAndThread* ft);
+
+    // 协程析构时释放自带的节点
+    static void DeleteTaskNode(void* node);
+
+    // 一个调度类别的优先级队列，定义在 scheduler.cc 中
+    struct PriorityQueue;
+
+    /**
+     *  把任务放入队列，返回是否需要唤醒空闲线程，空任务直接释放
+     *  调度线程自己提交的任务放入本地队列，外部线程提交、指定线程以及本地队列满时放入全局队列
+    */
+    bool scheduleTask(FiberAndThread* ft);
+
+    // 把切出为 READY 的协程放回本地队列尾部，排在已有任务之后，避免一直占用线程
+    void requeue(Worker* worker, FiberAndThread* ft);
+
+    /**
+     *  放入全局队列，返回是否需要唤醒空闲线程
+     *  没有指定线程的任务进入无锁注入队列，指定线程的任务进入目标线程的专属队列，
+     *  目标线程空闲时直接唤醒它，不需要再唤醒其他线程
+    */
+    bool pushGlobal(FiberAndThread* ft);
+
+    /**
+     *  获取下一个任务：HIGH -> 带截止时间的 NORMAL -> 本地队列 -> 指定线程的任务
+     *  -> 注入队列 -> 从其他线程窃取 -> BACKGROUND
+     *  防饿死的那一次调度按 BACKGROUND -> NORMAL -> HIGH 的顺序取
+    */
+    FiberAndThread* nextTask(Worker* worker);
+
+    // 取出一个指定在当前线程执行的任务
+    FiberAndThread* takePinned(Worker* worker);
+
+    // 线程启动时绑定工作线程，并取走启动前指定给它的任务
+    void registerWorker(Worker* worker);
+
+    // 工作线程的调度循环
+    void runWorker(Worker* worker);
+
+    // 调用了 switchTo 的协程切出后，把它（复用任务节点 ft）交给目标调度器
+    void handOff(Worker* worker, FiberAndThread* ft);
+
+    // 任务切出，记录切换次数，begin 不为 0（被采样的任务）时记录运行时间
+    void endSlice(Worker* worker, uint64_t begin);
+
+    // 分配一个新的工作线程（需要持有 m_mutex），槽位用完时复用已经退出的工作线程
+    Worker* newWorker();
+
+    // 为工作线程创建线程（需要持有 m_mutex）
+    void startWorker(Worker* worker);
+
+    /**
+     *  退休中的线程交出本地队列和指定给它的任务（绑定在该线程上的共享栈协程除外）
+     *  没有绑定的共享栈协程时标记为已退休，返回是否已退休
+    */
+    bool retireWorker(Worker* worker);
+
+    // 根据线程id查找工作线程，线程还没有启动或不属于该调度器时返回 nullptr
+    Worker* findWorker(int thread) const;
+
+    // 从注入队列取出一个任务，并顺带取一批到本地队列；其他线程正在取时直接返回
+    FiberAndThread* takeInject(Worker* worker);
+
+    // 从 priority 类别的优先级队列中取出截止时间最早的任务
+    FiberAndThread* takePriority(int priority);
+
+    // 从其他线程的本地队列头部窃取一半任务，优先窃取同一 NUMA 节点上的线程
+    FiberAndThread* steal(Worker* worker);
+
 private:
     MutexType m_mutex;
     // 线程池：用来执行函数
     std::vector<Thread::ptr> m_threads;
-    // 任务池：封装携程对象，记录任务
-    std::list<FiberAndThread> m_fibers;
+    // 指定的线程还没有启动时暂存的任务（侵入式单链表，m_mutex 保护），线程启动时取走
+    FiberAndThread* m_pinnedHead = nullptr;
+    FiberAndThread* m_pinnedTail = nullptr;
+    // 注入队列：外部线程提交以及本地队列溢出的任务，入队无锁
+    MpscQueue<FiberAndThread> m_injectQueue;
+    std::atomic<size_t> m_injectTaskCount = {0};
+    // 是否有线程正在从注入队列中取任务（同一时刻只允许一个消费者）
+    std::atomic<bool> m_injectPopping = {false};
+    // 所有队列中还没有开始执行的任务数
+    std::atomic<size_t> m_pendingTaskCount = {0};
+    // 挂起等待外部线程重新调度的协程数
+    std::atomic<size_t> m_externalWaits = {0};
+    // 各调度类别的优先级队列，不指定线程的非 NORMAL 或带截止时间的任务放在这里
+    PriorityQueue* m_priorityQueues[PRIORITY_COUNT];
+    // 工作线程槽位，构造时按最大线程数分配，[0, m_workerCount) 已经使用；
+    // use_caller 时 0 号是调度器所在线程
+    std::vector<Worker*> m_workers;
+    std::atomic<size_t> m_workerCount = {0};
+    // 工作线程绑定的 CPU
+    std::vector<int> m_cpus;
+    // scheduler.threads 配置的监听器
+    uint64_t m_threadsListener = 0;
     // 记录调度器的主协程
     Fiber::ptr m_rootFiber;
     std::string m_name;
+    // 已结束协程的栈使用水位
+    Histogram m_stackUsage;
+    // 空闲线程栈：停放中的工作线程
+    mutable SpinLock m_idleLock;
+    std::vector<Worker*> m_parkedWorkers;
+    std::atomic<size_t> m_parkedCount = {0};
+    std::atomic<uint64_t> m_wakeups = {0};
+    std::atomic<uint64_t> m_spuriousWakeups = {0};
+    std::atomic<uint64_t> m_externalTickles = {0};
+    // drain 状态：截止时间（毫秒）、是否已到截止时间、拒绝的任务数、截止时间到达时的快照
+    std::atomic<bool> m_draining = {false};
+    std::atomic<bool> m_drainExpired = {false};
+    std::atomic<uint64_t> m_drainDeadline = {0};
+    std::atomic<uint64_t> m_rejectedTasks = {0};
+    DrainResult m_drainResult;
 protected:
     std::vector<int> m_threadIds;
     size_t m_threadCount = 0;
@@ -152,6 +508,23 @@ protected:
     int m_rootThread = 0;
 };
 
+/**
+ *  作用域内切换到 target 调度器上执行，离开作用域时切回构造时所在的调度器
+ *  例如：
+ *      {
+ *          SchedulerSwitcher sw(cpu_scheduler);
+ *          // 在计算调度器上执行，不占用 epoll 线程
+ *      }
+ *      // 回到原来的 IOManager
+*/
+class SchedulerSwitcher : Noncopyable{
+public:
+    SchedulerSwitcher(Scheduler* target = nullptr);
+    ~SchedulerSwitcher();
+private:
+    Scheduler* m_caller;
+};
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,218 @@
+#ifndef __SMALL_CALLABLE_H__
+#define __SMALL_CALLABLE_H__
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace coServer{
+
+/**
+ *  只能移动的 void() 可调用对象
+ *  不超过 INLINE_SIZE 字节、可以无异常移动的函数对象直接构造在内部缓冲区里，不申请堆内存；
+ *  std::function 的内部缓冲区只有 16 字节，捕获稍多的 lambda 每次拷贝都要申请内存
+ *  可拷贝的函数对象可以通过 clone() 复制一份（循环定时器每次触发时使用）
+*/
+class SmallCallable{
+public:
+    static const size_t INLINE_SIZE = 64;
+
+    SmallCallable() {}
+
+    SmallCallable(std::nullptr_t) {}
+
+    template<class F, class = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, SmallCallable>::value>::type
+        ,class = decltype(std::declval<typename std::decay<F>::type&>()())>
+    SmallCallable(F&& f){
+        typedef typename std::decay<F>::type T;
+        if(IsNull(f)){
+            return;
+        }
+        if(IsInline<T>::value){
+            new (&m_storage) T(std::forward<F>(f));
+            m_ops = &InlineOps<T>::s_ops;
+        }
+        else{
+            m_heap = new T(std::forward<F>(f));
+            m_ops = &HeapOps<T>::s_ops;
+        }
+    }
+
+    SmallCallable(SmallCallable&& other) noexcept{
+        moveFrom(other);
+    }
+
+    SmallCallable& operator=(SmallCallable&& other) noexcept{
+        if(this != &other){
+            clear();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    SmallCallable& operator=(std::nullptr_t){
+        clear();
+        return *this;
+    }
+
+    SmallCallable(const SmallCallable&) = delete;
+    SmallCallable& operator=(const SmallCallable&) = delete;
+
+    ~SmallCallable(){
+        clear();
+    }
+
+    explicit operator bool() const {return m_ops != nullptr;}
+
+    void operator()(){
+        m_ops->invoke(data());
+    }
+
+    // 复制一份，函数对象不可拷贝时返回空对象
+    SmallCallable clone() const{
+        SmallCallable rt;
+        if(m_ops && m_ops->clone){
+            m_ops->clone(&rt, data());
+            rt.m_ops = m_ops;
+        }
+        return rt;
+    }
+
+    // 函数对象是否可以 clone
+    bool isCloneable() const {return m_ops && m_ops->clone;}
+
+    // 函数对象是否存放在内部缓冲区
+    bool isInline() const {return m_ops && m_ops->isInline;}
+
+    void swap(SmallCallable& other){
+        SmallCallable tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+private:
+    struct Ops{
+        void (*invoke)(void* obj);
+        // 用 src 移动构造 dst 并析构 src
+        void (*relocate)(SmallCallable* dst, SmallCallable* src);
+        void (*destroy)(SmallCallable* self);
+        // 用 obj 拷贝构造到 dst，不可拷贝时为 nullptr
+        void (*clone)(SmallCallable* dst, const void* obj);
+        bool isInline;
+    };
+
+    template<class T>
+    struct IsInline{
+        static const bool value = sizeof(T) <= INLINE_SIZE
+            && alignof(T) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<T>::value;
+    };
+
+    template<class T>
+    struct InlineOps{
+        static void Invoke(void* obj){
+            (*(T*)obj)();
+        }
+        static void Relocate(SmallCallable* dst, SmallCallable* src){
+            T* obj = (T*)&src->m_storage;
+            new (&dst->m_storage) T(std::move(*obj));
+            obj->~T();
+        }
+        static void Destroy(SmallCallable* self){
+            ((T*)&self->m_storage)->~T();
+        }
+        static void Clone(SmallCallable* dst, const void* obj){
+            new (&dst->m_storage) T(*(const T*)obj);
+        }
+        static const Ops s_ops;
+    };
+
+    template<class T>
+    struct HeapOps{
+        static void Invoke(void* obj){
+            (*(T*)obj)();
+        }
+        static void Relocate(SmallCallable* dst, SmallCallable* src){
+            dst->m_heap = src->m_heap;
+            src->m_heap = nullptr;
+        }
+        static void Destroy(SmallCallable* self){
+            delete (T*)self->m_heap;
+        }
+        static void Clone(SmallCallable* dst, const void* obj){
+            dst->m_heap = new T(*(const T*)obj);
+        }
+        static const Ops s_ops;
+    };
+
+    typedef void (*CloneFunc)(SmallCallable*, const void*);
+
+    // 只有可拷贝的函数对象才实例化 Clone
+    template<class OpsT, bool Copyable>
+    struct CloneOf{
+        static constexpr CloneFunc get() {return &OpsT::Clone;}
+    };
+
+    template<class OpsT>
+    struct CloneOf<OpsT, false>{
+        static constexpr CloneFunc get() {return nullptr;}
+    };
+
+    template<class F>
+    static bool IsNull(const F&) {return false;}
+
+    static bool IsNull(void (*f)()) {return !f;}
+
+    template<class R, class... Args>
+    static bool IsNull(const std::function<R(Args...)>& f) {return !f;}
+
+    void* data() const{
+        return m_ops->isInline ? (void*)&m_storage : m_heap;
+    }
+
+    void moveFrom(SmallCallable& other){
+        m_ops = other.m_ops;
+        if(m_ops){
+            m_ops->relocate(this, &other);
+            other.m_ops = nullptr;
+        }
+    }
+
+    void clear(){
+        if(m_ops){
+            const Ops* ops = m_ops;
+            m_ops = nullptr;
+            ops->destroy(this);
+        }
+    }
+private:
+    const Ops* m_ops = nullptr;
+    union{
+        typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type m_storage;
+        void* m_heap;
+    };
+};
+
+template<class T>
+const SmallCallable::Ops SmallCallable::InlineOps<T>::s_ops = {
+    &InlineOps<T>::Invoke,
+    &InlineOps<T>::Relocate,
+    &InlineOps<T>::Destroy,
+    SmallCallable::CloneOf<InlineOps<T>, std::is_copy_constructible<T>::value>::get(),
+    true
+};
+
+template<class T>
+const SmallCallable::Ops SmallCallable::HeapOps<T>::s_ops = {
+    &HeapOps<T>::Invoke,
+    &HeapOps<T>::Relocate,
+    &HeapOps<T>::Destroy,
+    SmallCallable::CloneOf<HeapOps<T>, std::is_copy_constructible<T>::value>::get(),
+    false
+};
+
+}
+
+#endif
@@ -0,0 +1,335 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <vector>
+
+#include "stack_allocator.h"
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+#include "numa.h"
+
+namespace coServer{
+
+static Logger::ptr g_logger = COSERVER_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_high =
+    Config::Lookup<uint32_t>("fiber.stack_pool.high", 64, "fiber stack thread cache high watermark");
+static ConfigVar<uint32_t>::ptr g_stack_pool_low =
+    Config::Lookup<uint32_t>("fiber.stack_pool.low", 16, "fiber stack thread cache low watermark");
+static ConfigVar<uint32_t>::ptr g_stack_pool_shared =
+    Config::Lookup<uint32_t>("fiber.stack_pool.shared", 256, "fiber stack shared pool capacity");
+static ConfigVar<uint32_t>::ptr g_stack_guard_pages =
+    Config::Lookup<uint32_t>("fiber.stack_guard_pages", 1, "fiber stack guard pages");
+
+static std::atomic<uint32_t> s_pool_high {64};
+static std::atomic<uint32_t> s_pool_low {16};
+static std::atomic<uint32_t> s_pool_shared {256};
+
+static std::atomic<uint64_t> s_hits {0};
+static std::atomic<uint64_t> s_misses {0};
+static std::atomic<uint64_t> s_unguarded {0};
+
+struct _StackPoolIniter{
+    _StackPoolIniter(){
+        s_pool_high = g_stack_pool_high->getValue();
+        s_pool_low = g_stack_pool_low->getValue();
+        s_pool_shared = g_stack_pool_shared->getValue();
+        g_stack_pool_high->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            COSERVER_LOG_INFO(g_logger) << "fiber stack pool high watermark changed from "
+                << old_value << " to " << new_value;
+            s_pool_high = new_value;
+        });
+        g_stack_pool_low->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            COSERVER_LOG_INFO(g_logger) << "fiber stack pool low watermark changed from "
+                << old_value << " to " << new_value;
+            s_pool_low = new_value;
+        });
+        g_stack_pool_shared->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            COSERVER_LOG_INFO(g_logger) << "fiber stack shared pool capacity changed from "
+                << old_value << " to " << new_value;
+            s_pool_shared = new_value;
+        });
+    }
+};
+
+static _StackPoolIniter s_stack_pool_initer;
+
+static size_t GetPageSize(){
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+static size_t RoundUp(size_t size){
+    size_t page = GetPageSize();
+    return (size + page - 1) & ~(page - 1);
+}
+
+// 栈底保护页大小，第一次分配时确定，之后修改配置不再生效（否则释放时无法还原映射）
+static size_t GetGuardSize(){
+    static size_t s_guard_size = g_stack_guard_pages->getValue() * GetPageSize();
+    return s_guard_size;
+}
+
+/**
+ *  直接向系统申请栈内存
+ *  MAP_NORESERVE 只保留地址空间，物理页在第一次访问时才分配；
+ *  栈向低地址增长，在栈底放 PROT_NONE 的保护页，栈溢出时直接 SIGSEGV 而不是踩坏相邻内存
+*/
+static void* RawAlloc(size_t size){
+    size_t guard = GetGuardSize();
+    size_t len = RoundUp(size) + guard;
+    void* vp = mmap(nullptr, len, PROT_READ | PROT_WRITE
+            ,MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    if(vp == MAP_FAILED){
+        COSERVER_LOG_ERROR(g_logger) << "mmap fiber stack size=" << len
+            << " errno=" << errno << " " << strerror(errno);
+        return nullptr;
+    }
+    if(guard && mprotect(vp, guard, PROT_NONE)){
+        // 保护页让每个栈多占一个映射，协程很多时会超过 vm.max_map_count（ENOMEM）；
+        // 这时不设保护页，映射布局不变，释放时按同样的长度 munmap
+        if(s_unguarded++ == 0){
+            COSERVER_LOG_WARN(g_logger) << "mprotect fiber stack guard size=" << guard
+                << " errno=" << errno << " " << strerror(errno)
+                << ", fall back to stacks without guard page";
+        }
+    }
+    // 绑定了 CPU 的线程，栈放在它所在的 NUMA 节点上
+    BindMemoryToNode((char*)vp + guard, RoundUp(size), GetCurrentNumaNode());
+    return (char*)vp + guard;
+}
+
+static void RawDealloc(void* vp, size_t size){
+    size_t guard = GetGuardSize();
+    if(munmap((char*)vp - guard, RoundUp(size) + guard)){
+        COSERVER_LOG_ERROR(g_logger) << "munmap fiber stack " << vp
+            << " errno=" << errno << " " << strerror(errno);
+    }
+}
+
+// 把栈的物理页还给内核，虚拟地址保留
+static void Discard(void* vp, size_t size){
+    size_t len = RoundUp(size);
+    if(madvise(vp, len, MADV_DONTNEED)){
+        COSERVER_LOG_ERROR(g_logger) << "madvise(" << vp << ", " << len
+            << ", MADV_DONTNEED) errno=" << errno << " " << strerror(errno);
+    }
+}
+
+// 同一大小的空闲栈列表
+struct StackBucket{
+    size_t size;
+    std::vector<void*> stacks;
+};
+
+static StackBucket* FindBucket(std::vector<StackBucket>& buckets, size_t size, bool auto_create){
+    for(auto& i : buckets){
+        if(i.size == size){
+            return &i;
+        }
+    }
+    if(!auto_create){
+        return nullptr;
+    }
+    buckets.push_back(StackBucket{size, {}});
+    return &buckets.back();
+}
+
+// 共享池
+struct SharedStackPool{
+    typedef Mutex MutexType;
+
+    // 放入共享池，超过容量的栈直接释放
+    void put(size_t size, void** stacks, size_t count){
+        for(size_t i = 0; i < count; ++i){
+            Discard(stacks[i], size);
+        }
+        size_t freed = 0;
+        {
+            MutexType::Lock lock(mutex);
+            StackBucket* bucket = FindBucket(buckets, size, true);
+            for(size_t i = 0; i < count; ++i){
+                if(total < s_pool_shared){
+                    bucket->stacks.push_back(stacks[i]);
+                    ++total;
+                }
+                else{
+                    stacks[freed++] = stacks[i];
+                }
+            }
+        }
+        for(size_t i = 0; i < freed; ++i){
+            RawDealloc(stacks[i], size);
+        }
+    }
+
+    // 从共享池中最多取出 count 个栈
+    size_t take(size_t size, std::vector<void*>& out, size_t count){
+        MutexType::Lock lock(mutex);
+        StackBucket* bucket = FindBucket(buckets, size, false);
+        if(!bucket){
+            return 0;
+        }
+        size_t n = 0;
+        while(n < count && !bucket->stacks.empty()){
+            out.push_back(bucket->stacks.back());
+            bucket->stacks.pop_back();
+            ++n;
+        }
+        total -= n;
+        return n;
+    }
+
+    void trim(){
+        std::vector<StackBucket> tmp;
+        {
+            MutexType::Lock lock(mutex);
+            tmp.swap(buckets);
+            total = 0;
+        }
+        for(auto& i : tmp){
+            for(auto& vp : i.stacks){
+                RawDealloc(vp, i.size);
+            }
+        }
+    }
+
+    MutexType mutex;
+    std::vector<StackBucket> buckets;
+    size_t total = 0;
+};
+
+static SharedStackPool& GetSharedPool(){
+    // 不析构，线程退出时还可能归还栈
+    static SharedStackPool* s_pool = new SharedStackPool;
+    return *s_pool;
+}
+
+// 线程缓存
+// 线程退出时线程缓存可能先于其他线程局部对象析构，之后归还的栈直接进入共享池
+static thread_local bool t_stack_cache_destroyed = false;
+
+struct ThreadStackCache{
+    ~ThreadStackCache(){
+        flush();
+        t_stack_cache_destroyed = true;
+    }
+
+    void* alloc(size_t size){
+        StackBucket* bucket = FindBucket(buckets, size, false);
+        if(!bucket || bucket->stacks.empty()){
+            // 线程缓存为空，从共享池补充到低水位
+            uint32_t low = s_pool_low;
+            if(!bucket){
+                bucket = FindBucket(buckets, size, true);
+            }
+            size_t n = GetSharedPool().take(size, bucket->stacks, low ? low : 1);
+            if(!n){
+                return nullptr;
+            }
+            total += n;
+            // 共享池中的栈可能来自其他节点的线程，物理页已经归还，重新绑定到当前节点
+            int node = GetCurrentNumaNode();
+            if(node >= 0){
+                for(size_t i = bucket->stacks.size() - n; i < bucket->stacks.size(); ++i){
+                    BindMemoryToNode(bucket->stacks[i], RoundUp(size), node);
+                }
+            }
+        }
+        void* vp = bucket->stacks.back();
+        bucket->stacks.pop_back();
+        --total;
+        return vp;
+    }
+
+    void dealloc(void* vp, size_t size){
+        StackBucket* bucket = FindBucket(buckets, size, true);
+        bucket->stacks.push_back(vp);
+        ++total;
+        if(total > s_pool_high){
+            spill();
+        }
+    }
+
+    // 超过高水位，从栈最多的桶开始挪到共享池，直到降到低水位
+    void spill(){
+        uint32_t low = s_pool_low;
+        while(total > low){
+            StackBucket* largest = nullptr;
+            for(auto& i : buckets){
+                if(!largest || i.stacks.size() > largest->stacks.size()){
+                    largest = &i;
+                }
+            }
+            if(!largest || largest->stacks.empty()){
+                break;
+            }
+            size_t n = std::min(largest->stacks.size(), total - low);
+            GetSharedPool().put(largest->size, &largest->stacks[largest->stacks.size() - n], n);
+            largest->stacks.resize(largest->stacks.size() - n);
+            total -= n;
+        }
+    }
+
+    void flush(){
+        for(auto& i : buckets){
+            if(!i.stacks.empty()){
+                GetSharedPool().put(i.size, &i.stacks[0], i.stacks.size());
+                i.stacks.clear();
+            }
+        }
+        total = 0;
+    }
+
+    std::vector<StackBucket> buckets;
+    size_t total = 0;
+};
+
+static thread_local ThreadStackCache t_stack_cache;
+
+void* StackAllocator::Alloc(size_t size){
+    void* vp = t_stack_cache_destroyed ? nullptr : t_stack_cache.alloc(size);
+    if(vp){
+        ++s_hits;
+        return vp;
+    }
+    ++s_misses;
+    vp = RawAlloc(size);
+    COSERVER_ASSERT2(vp, "alloc fiber stack size=" << size);
+    return vp;
+}
+
+void StackAllocator::Dealloc(void* vp, size_t size){
+    if(COSERVER_UNLIKELY(t_stack_cache_destroyed)){
+        GetSharedPool().put(size, &vp, 1);
+        return;
+    }
+    t_stack_cache.dealloc(vp, size);
+}
+
+void StackAllocator::Flush(){
+    if(!t_stack_cache_destroyed){
+        t_stack_cache.flush();
+    }
+}
+
+void StackAllocator::Trim(){
+    GetSharedPool().trim();
+}
+
+uint64_t StackAllocator::GetHits(){
+    return s_hits;
+}
+
+uint64_t StackAllocator::GetMisses(){
+    return s_misses;
+}
+
+uint64_t StackAllocator::GetUnguarded(){
+    return s_unguarded;
+}
+
+}
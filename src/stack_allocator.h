@@ -0,0 +1,44 @@
+#ifndef __STACK_ALLOCATOR_H__
+#define __STACK_ALLOCATOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace coServer{
+
+/**
+ *  协程栈分配器
+ *  栈用 mmap(MAP_NORESERVE) 申请，物理页按需提交，栈底带 fiber.stack_guard_pages 个保护页；
+ *  每个线程缓存一部分空闲栈，超过高水位时把多余的栈（降到低水位）挪到共享池；
+ *  进入共享池的栈用 madvise(MADV_DONTNEED) 归还物理页，突发流量过后 RSS 能降下来
+ *  fiber.stack_pool.high   : 线程缓存高水位
+ *  fiber.stack_pool.low    : 线程缓存低水位
+ *  fiber.stack_pool.shared : 共享池最多保存的栈数量，超过直接释放
+*/
+class StackAllocator{
+public:
+    // 分配协程栈，优先从线程缓存和共享池中获取
+    static void* Alloc(size_t size);
+
+    // 回收协程栈到线程缓存
+    static void Dealloc(void* vp, size_t size);
+
+    // 把当前线程缓存中的栈全部挪到共享池
+    static void Flush();
+
+    // 释放共享池中所有的栈
+    static void Trim();
+
+    // 命中缓存的次数
+    static uint64_t GetHits();
+
+    // 未命中缓存，重新申请内存的次数
+    static uint64_t GetMisses();
+
+    // 设置保护页失败（映射数达到 vm.max_map_count），没有保护页的栈的数量
+    static uint64_t GetUnguarded();
+};
+
+}
+
+#endif
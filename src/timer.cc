@@ -1,4 +1,6 @@
 #include "timer.h"
+#include "log.h"
+#include "macro.h"
 #include "util.h"
 
 namespace coServer{
@@ -23,11 +25,11 @@ bool Timer::Comparator::operator()(const Timer::ptr& lhs
     return lhs.get() < rhs.get();
 }
 
-Timer::Timer(uint64_t ms, std::function<void()> cb,
+Timer::Timer(uint64_t ms, SmallCallable cb,
              bool recurring, TimerManager* manager)
     :m_recurring(recurring)
     ,m_ms(ms)
-    ,m_cb(cb)
+    ,m_cb(std::move(cb))
     ,m_manager(manager) {
     m_next = coServer::GetCurrentMS() + m_ms;
 }
@@ -93,25 +95,45 @@ TimerManager::TimerManager(){
 TimerManager::~TimerManager(){}
 
 // 将定时器添加到 manager 中
-Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb
+Timer::ptr TimerManager::addTimer(uint64_t ms, SmallCallable cb
                                   ,bool recurring) {
-    Timer::ptr timer(new Timer(ms, cb, recurring, this));
+    COSERVER_ASSERT2(!recurring || !cb || cb.isCloneable(), "recurring timer callback must be copyable");
+    Timer::ptr timer(new Timer(ms, std::move(cb), recurring, this));
     RWMutexType::WriteLock lock(m_mutex);
     addTimer(timer, lock);
     return timer;
 }
 
-static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb) {
-    std::shared_ptr<void> tmp = weak_cond.lock();
-    if(tmp) {
-        cb();
+// 条件定时器的回调，条件对象还存在时才执行
+struct ConditionTimerCb {
+    ConditionTimerCb(std::weak_ptr<void> cond, SmallCallable&& f)
+        :weak_cond(std::move(cond))
+        ,cb(std::move(f)) {}
+
+    // 循环条件定时器每次触发时拷贝
+    ConditionTimerCb(const ConditionTimerCb& other)
+        :weak_cond(other.weak_cond)
+        ,cb(other.cb.clone()) {}
+
+    ConditionTimerCb(ConditionTimerCb&&) = default;
+
+    void operator()() {
+        std::shared_ptr<void> tmp = weak_cond.lock();
+        if(tmp) {
+            cb();
+        }
     }
-}
 
-Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
+    std::weak_ptr<void> weak_cond;
+    SmallCallable cb;
+};
+
+Timer::ptr TimerManager::addConditionTimer(uint64_t ms, SmallCallable cb
                                     ,std::weak_ptr<void> weak_cond
                                     ,bool recurring) {
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+    // 包装后的回调总是可以拷贝，要在包装之前检查，否则循环触发时拷贝出空回调
+    COSERVER_ASSERT2(!recurring || !cb || cb.isCloneable(), "recurring condition timer callback must be copyable");
+    return addTimer(ms, ConditionTimerCb(std::move(weak_cond), std::move(cb)), recurring);
 }
 
 // 下一个定时器的执行时间
@@ -132,7 +154,7 @@ uint64_t TimerManager::getNextTimer() {
 }
 
 // 已经超过等待时间，需要执行的回调函数集合
-void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
+void TimerManager::listExpiredCb(std::vector<SmallCallable>& cbs) {
     uint64_t now_ms = coServer::GetCurrentMS();
     std::vector<Timer::ptr> expired;
     {
@@ -160,12 +182,13 @@ void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs) {
     cbs.reserve(expired.size());
 
     for(auto& timer : expired) {
-        cbs.push_back(timer->m_cb);
         if(timer->m_recurring) {
+            cbs.push_back(timer->m_cb.clone());
             timer->m_next = now_ms + timer->m_ms;
             m_timers.insert(timer);
         } else {
-            timer->m_cb = nullptr;
+            // 移出后 m_cb 为空，cancel 不再生效
+            cbs.push_back(std::move(timer->m_cb));
         }
     }
 }
@@ -198,4 +221,9 @@ bool TimerManager::hasTimer() {
     return !m_timers.empty();
 }
 
+size_t TimerManager::getTimerCount() {
+    RWMutexType::ReadLock lock(m_mutex);
+    return m_timers.size();
+}
+
 }
\ No newline at end of file
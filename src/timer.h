@@ -5,6 +5,7 @@
 #include <vector>
 #include <set>
 
+#include "small_callable.h"
 #include "thread.h"
 
 namespace coServer{
@@ -37,7 +38,7 @@ private:
      * recurring : 是否循环
      * manager ： 定时管理器
     */
-    Timer(uint64_t ms, std::function<void()> cb,
+    Timer(uint64_t ms, SmallCallable cb,
         bool recurring, TimerManager* manager);
     
     /**
@@ -49,7 +50,7 @@ private:
     bool m_recurring = false;           // 是否是循环定时器
     uint64_t m_ms = 0;                  // 执行周期
     uint64_t m_next = 0;                // 精确的执行时间（需要执行cb的时间戳）
-    std::function<void()> m_cb;         // 回调函数
+    SmallCallable m_cb;                 // 回调函数
     TimerManager* m_manager = nullptr;  // 定时器管理
 
 private:
@@ -70,28 +71,30 @@ public:
     /**
      * 添加定时器
      * ms : 定时器回调函数
-     * recurring : 是否循环定时器 
+     * recurring : 是否循环定时器，每次触发时 clone 一份回调，回调需要可拷贝
     */
-    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb
+    Timer::ptr addTimer(uint64_t ms, SmallCallable cb
         ,bool recurring = false);
 
     /**
      * 添加条件定时器
      * ms : 定时器执行间隔时间
-     * cb : 定时器回调函数
+     * cb : 定时器回调函数，循环定时器的回调需要可拷贝
      * weak_cond : 条件
      * recurring : 是否循环
     */
-    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb
+    Timer::ptr addConditionTimer(uint64_t ms, SmallCallable cb
         ,std::weak_ptr<void> weak_cond
         ,bool recurring = false);
 
     // 离最近一个定时器执行的时间间隔（毫秒）
     uint64_t getNextTimer();
-    // 获取需要执行的定时器回调函数列表
-    void listExpiredCb(std::vector<std::function<void()>>& cbs);
+    // 获取需要执行的定时器回调函数列表，单次定时器的回调直接移出
+    void listExpiredCb(std::vector<SmallCallable>& cbs);
     // 是否有定时器
     bool hasTimer();
+    // 定时器数量
+    size_t getTimerCount();
 
 protected:
     // 当有新的定时器插入到定时器的首部，执行该函数
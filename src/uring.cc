@@ -0,0 +1,334 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+#include "log.h"
+#include "macro.h"
+
+namespace coServer{
+
+static Logger::ptr g_logger = COSERVER_LOG_NAME("system");
+
+static int io_uring_setup(uint32_t entries, io_uring_params* p){
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete
+        ,uint32_t flags, const void* arg, size_t argsz){
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+IoRequest IoRequest::Recv(int fd, void* buf, size_t len, int flags){
+    IoRequest req;
+    req.op = RECV;
+    req.fd = fd;
+    req.addr = (uint64_t)(uintptr_t)buf;
+    req.len = len;
+    req.flags = flags;
+    return req;
+}
+
+IoRequest IoRequest::Send(int fd, const void* buf, size_t len, int flags){
+    IoRequest req = Recv(fd, (void*)buf, len, flags);
+    req.op = SEND;
+    return req;
+}
+
+IoRequest IoRequest::Readv(int fd, const struct iovec* iov, int iovcnt){
+    IoRequest req;
+    req.op = READV;
+    req.fd = fd;
+    req.addr = (uint64_t)(uintptr_t)iov;
+    req.len = iovcnt;
+    return req;
+}
+
+IoRequest IoRequest::Writev(int fd, const struct iovec* iov, int iovcnt){
+    IoRequest req = Readv(fd, iov, iovcnt);
+    req.op = WRITEV;
+    return req;
+}
+
+IoRequest IoRequest::RecvMsg(int fd, struct msghdr* msg, int flags){
+    IoRequest req;
+    req.op = RECVMSG;
+    req.fd = fd;
+    req.addr = (uint64_t)(uintptr_t)msg;
+    req.len = 1;
+    req.flags = flags;
+    return req;
+}
+
+IoRequest IoRequest::SendMsg(int fd, const struct msghdr* msg, int flags){
+    IoRequest req = RecvMsg(fd, (struct msghdr*)msg, flags);
+    req.op = SENDMSG;
+    return req;
+}
+
+IoRequest IoRequest::Accept(int fd, struct sockaddr* addr, socklen_t* addrlen){
+    IoRequest req;
+    req.op = ACCEPT;
+    req.fd = fd;
+    req.addr = (uint64_t)(uintptr_t)addr;
+    req.off = (uint64_t)(uintptr_t)addrlen;
+    return req;
+}
+
+IoRequest IoRequest::Connect(int fd, const struct sockaddr* addr, socklen_t addrlen){
+    IoRequest req;
+    req.op = CONNECT;
+    req.fd = fd;
+    req.addr = (uint64_t)(uintptr_t)addr;
+    req.off = addrlen;
+    return req;
+}
+
+IoUring* IoUring::Create(uint32_t entries){
+    IoUring* ring = new IoUring;
+    if(!ring->init(entries)){
+        delete ring;
+        return nullptr;
+    }
+    return ring;
+}
+
+bool IoUring::init(uint32_t entries){
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_fd = io_uring_setup(entries, &params);
+    if(m_fd < 0){
+        COSERVER_LOG_WARN(g_logger) << "io_uring_setup entries=" << entries
+            << " errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+    // 依赖 EXT_ARG（带超时的等待）、取消 fd 上的所有请求等较新的特性
+    uint32_t need = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+    if((params.features & need) != need){
+        COSERVER_LOG_WARN(g_logger) << "io_uring features=" << params.features << " not supported";
+        return false;
+    }
+    m_entries = params.sq_entries;
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE
+            ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE
+            ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE
+            ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if(m_sqRing == MAP_FAILED || m_cqRing == MAP_FAILED || sqes == MAP_FAILED){
+        COSERVER_LOG_ERROR(g_logger) << "io_uring mmap errno=" << errno << " " << strerror(errno);
+        m_sqRing = m_sqRing == MAP_FAILED ? nullptr : m_sqRing;
+        m_cqRing = m_cqRing == MAP_FAILED ? nullptr : m_cqRing;
+        m_sqes = sqes == MAP_FAILED ? nullptr : (io_uring_sqe*)sqes;
+        return false;
+    }
+    m_sqes = (io_uring_sqe*)sqes;
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead = (uint32_t*)(sq + params.sq_off.head);
+    m_sqTail = (uint32_t*)(sq + params.sq_off.tail);
+    m_sqMask = *(uint32_t*)(sq + params.sq_off.ring_mask);
+    m_sqArray = (uint32_t*)(sq + params.sq_off.array);
+
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (uint32_t*)(cq + params.cq_off.head);
+    m_cqTail = (uint32_t*)(cq + params.cq_off.tail);
+    m_cqMask = *(uint32_t*)(cq + params.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+IoUring::~IoUring(){
+    if(m_sqes){
+        munmap(m_sqes, m_sqesSize);
+    }
+    if(m_cqRing){
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    if(m_sqRing){
+        munmap(m_sqRing, m_sqRingSize);
+    }
+    if(m_fd >= 0){
+        close(m_fd);
+    }
+}
+
+io_uring_sqe* IoUring::getSqe(){
+    uint32_t head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    uint32_t tail = *m_sqTail;
+    if(tail - head >= m_entries){
+        return nullptr;
+    }
+    io_uring_sqe* sqe = &m_sqes[tail & m_sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+template<class Fill>
+bool IoUring::submitSqe(Fill fill){
+    // 在锁内 io_uring_enter，队列中最多只有这一个未提交的请求，失败时可以安全撤回
+    Mutex::Lock lock(m_sqLock);
+    io_uring_sqe* sqe = getSqe();
+    if(COSERVER_UNLIKELY(!sqe)){
+        COSERVER_LOG_ERROR(g_logger) << "io_uring submission queue full";
+        errno = EBUSY;
+        return false;
+    }
+    fill(sqe);
+    uint32_t tail = *m_sqTail;
+    m_sqArray[tail & m_sqMask] = tail & m_sqMask;
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+    int rt;
+    do{
+        rt = io_uring_enter(m_fd, 1, 0, 0, nullptr, 0);
+    }while(rt < 0 && errno == EINTR);
+    if(rt > 0 || __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) != tail){
+        return true;
+    }
+    // 内核没有取走请求，撤回，否则下次 io_uring_enter 会提交调用者已经放弃的请求
+    int err = rt < 0 ? errno : EAGAIN;
+    __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+    if(err != EAGAIN && err != EBUSY){
+        COSERVER_LOG_ERROR(g_logger) << "io_uring_enter submit errno=" << err
+            << " " << strerror(err);
+    }
+    errno = err;
+    return false;
+}
+
+bool IoUring::submit(const IoRequest& req, uint64_t user_data){
+    uint8_t opcode = 0;
+    switch(req.op){
+        case IoRequest::RECV:
+            opcode = IORING_OP_RECV;
+            break;
+        case IoRequest::SEND:
+            opcode = IORING_OP_SEND;
+            break;
+        case IoRequest::READV:
+            opcode = IORING_OP_READV;
+            break;
+        case IoRequest::WRITEV:
+            opcode = IORING_OP_WRITEV;
+            break;
+        case IoRequest::RECVMSG:
+            opcode = IORING_OP_RECVMSG;
+            break;
+        case IoRequest::SENDMSG:
+            opcode = IORING_OP_SENDMSG;
+            break;
+        case IoRequest::ACCEPT:
+            opcode = IORING_OP_ACCEPT;
+            break;
+        case IoRequest::CONNECT:
+            opcode = IORING_OP_CONNECT;
+            break;
+        default:
+            COSERVER_ASSERT2(false, "io_uring invalid op " << req.op);
+    }
+    return submitSqe([&req, opcode, user_data](io_uring_sqe* sqe){
+        sqe->opcode = opcode;
+        sqe->fd = req.fd;
+        sqe->addr = req.addr;
+        sqe->len = req.len;
+        sqe->off = req.off;
+        sqe->msg_flags = req.flags;
+        sqe->user_data = user_data;
+    });
+}
+
+bool IoUring::submitPoll(int fd, uint32_t events, uint64_t user_data, bool multishot){
+    return submitSqe([=](io_uring_sqe* sqe){
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = events;
+        sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+        sqe->user_data = user_data;
+    });
+}
+
+bool IoUring::submitPollRemove(uint64_t target, uint64_t user_data){
+    return submitSqe([=](io_uring_sqe* sqe){
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = target;
+        sqe->user_data = user_data;
+    });
+}
+
+bool IoUring::submitCancel(uint64_t target, uint64_t user_data){
+    return submitSqe([=](io_uring_sqe* sqe){
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = -1;
+        sqe->addr = target;
+        sqe->user_data = user_data;
+    });
+}
+
+bool IoUring::submitCancelFd(int fd, uint64_t user_data){
+    return submitSqe([=](io_uring_sqe* sqe){
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->fd = fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = user_data;
+    });
+}
+
+bool IoUring::wait(uint64_t timeout_ms){
+    if(hasCompletion()){
+        return true;
+    }
+    __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    int rt = io_uring_enter(m_fd, 0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG
+            ,&arg, sizeof(arg));
+    if(rt < 0 && errno != ETIME && errno != EINTR){
+        COSERVER_LOG_ERROR(g_logger) << "io_uring_enter wait errno=" << errno
+            << " " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool IoUring::hasCompletion() const{
+    return __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE) != *m_cqHead;
+}
+
+size_t IoUring::reap(IoCompletion* out, size_t max, bool try_lock){
+    if(try_lock){
+        if(!m_cqLock.tryLock()){
+            return 0;
+        }
+    }
+    else{
+        m_cqLock.lock();
+    }
+    uint32_t head = *m_cqHead;
+    uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    size_t n = 0;
+    while(head != tail && n < max){
+        io_uring_cqe* cqe = &m_cqes[head & m_cqMask];
+        out[n].userData = cqe->user_data;
+        out[n].res = cqe->res;
+        out[n].flags = cqe->flags;
+        ++n;
+        ++head;
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    m_cqLock.unlock();
+    return n;
+}
+
+}
@@ -0,0 +1,152 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "mutex.h"
+#include "noncopyable.h"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace coServer{
+
+/**
+ *  一个 IO 操作，由 IOManager 的 io_uring 后端直接提交给内核
+ *  只记录参数，缓冲区等由调用者保证在操作完成前有效
+*/
+struct IoRequest{
+    enum Op{
+        // 不支持直接提交，回退到等待就绪后再调用
+        NONE = 0,
+        RECV,
+        SEND,
+        READV,
+        WRITEV,
+        RECVMSG,
+        SENDMSG,
+        ACCEPT,
+        CONNECT
+    };
+
+    Op op = NONE;
+    int fd = -1;
+    // 缓冲区 / iovec / msghdr / sockaddr
+    uint64_t addr = 0;
+    // 长度 / iovec 个数
+    uint32_t len = 0;
+    // ACCEPT 的 socklen_t*，CONNECT 的地址长度
+    uint64_t off = 0;
+    // recv / send 的 flags
+    uint32_t flags = 0;
+
+    static IoRequest Recv(int fd, void* buf, size_t len, int flags = 0);
+    static IoRequest Send(int fd, const void* buf, size_t len, int flags = 0);
+    static IoRequest Readv(int fd, const struct iovec* iov, int iovcnt);
+    static IoRequest Writev(int fd, const struct iovec* iov, int iovcnt);
+    static IoRequest RecvMsg(int fd, struct msghdr* msg, int flags);
+    static IoRequest SendMsg(int fd, const struct msghdr* msg, int flags);
+    static IoRequest Accept(int fd, struct sockaddr* addr, socklen_t* addrlen);
+    static IoRequest Connect(int fd, const struct sockaddr* addr, socklen_t addrlen);
+};
+
+// 一个完成事件
+struct IoCompletion{
+    uint64_t userData;
+    // 操作的返回值，失败时为 -errno
+    int32_t res;
+    uint32_t flags;
+};
+
+/**
+ *  io_uring 提交 / 完成队列
+ *  直接使用 io_uring_setup / io_uring_enter 系统调用和 mmap 的共享队列，不依赖 liburing
+ *  多个线程可以同时提交（提交队列加锁，每次提交一个请求并在锁内 io_uring_enter）；
+ *  完成队列由持有锁的线程收割，收割后在锁外处理
+*/
+class IoUring : Noncopyable{
+public:
+    // 创建 entries 个提交项的队列，内核不支持（或被禁用）时返回 nullptr
+    static IoUring* Create(uint32_t entries);
+
+    ~IoUring();
+
+    int getFd() const {return m_fd;}
+
+    /**
+     *  提交 IO 操作，以下提交函数相同
+     *  返回 false 时请求一定没有进入内核，errno 为 EBUSY / EAGAIN 表示完成队列积压，收割后可以重试
+    */
+    bool submit(const IoRequest& req, uint64_t user_data);
+
+    // 监听 fd 上的 poll 事件（POLLIN / POLLOUT），multishot 时触发后保持监听
+    bool submitPoll(int fd, uint32_t events, uint64_t user_data, bool multishot = false);
+
+    // 取消 user_data 为 target 的 poll
+    bool submitPollRemove(uint64_t target, uint64_t user_data);
+
+    // 取消 user_data 为 target 的操作
+    bool submitCancel(uint64_t target, uint64_t user_data);
+
+    // 取消 fd 上的所有操作（包括 poll）
+    bool submitCancelFd(int fd, uint64_t user_data);
+
+    /**
+     *  等待至少一个完成事件，最多 timeout_ms 毫秒
+     *  返回 false 表示出错（超时、被信号中断不算出错）
+    */
+    bool wait(uint64_t timeout_ms);
+
+    // 完成队列是否有事件
+    bool hasCompletion() const;
+
+    /**
+     *  取出最多 max 个完成事件，返回个数
+     *  try_lock 为 true 时其他线程正在收割就直接返回 0
+    */
+    size_t reap(IoCompletion* out, size_t max, bool try_lock = false);
+
+    uint32_t getEntries() const {return m_entries;}
+private:
+    IoUring() = default;
+
+    bool init(uint32_t entries);
+
+    // 在提交锁内取一个空闲的提交项并清零，队列满时返回 nullptr
+    io_uring_sqe* getSqe();
+
+    // 取一个提交项，由 fill 填写后放入提交队列并调用 io_uring_enter，内核没有取走时撤回
+    template<class Fill>
+    bool submitSqe(Fill fill);
+private:
+    int m_fd = -1;
+    uint32_t m_entries = 0;
+
+    void* m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    void* m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    uint32_t* m_sqHead = nullptr;
+    uint32_t* m_sqTail = nullptr;
+    uint32_t m_sqMask = 0;
+    uint32_t* m_sqArray = nullptr;
+
+    uint32_t* m_cqHead = nullptr;
+    uint32_t* m_cqTail = nullptr;
+    uint32_t m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    // 持有期间会调用 io_uring_enter，不用自旋锁
+    Mutex m_sqLock;
+    SpinLock m_cqLock;
+};
+
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include <execinfo.h>
 #include <sys/time.h>
+#include <time.h>
 #include <dirent.h>
 #include <unistd.h>
 #include <string.h>
@@ -64,4 +65,10 @@ uint64_t GetCurrentUS(){
     return tv.tv_sec * 1000 * 1000ul + tv.tv_usec;
 }
 
+uint64_t GetCurrentNS(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000 * 1000ul + ts.tv_nsec;
+}
+
 }
\ No newline at end of file
@@ -30,6 +30,9 @@ uint64_t GetCurrentUS();
 
 uint64_t GetCurrentMS();
 
+// 单调时钟（纳秒），用于统计耗时
+uint64_t GetCurrentNS();
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include <errno.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+
+#include "src/fd_manager.h"
+#include "src/iomanager.h"
+#include "src/log.h"
+#include "src/thread.h"
+#include "src/util.h"
+
+/**
+ *  IOManager::drain 的测试
+ *  clean   : 只有短任务，不等截止时间直接停止
+ *  timeout : 一个空闲的长连接一直挂在读事件上（stop 会一直等下去），截止时间后被取消，
+ *            read 返回 ECANCELED；drain 期间外部提交的任务被拒绝，已有的任务都执行完
+ *  caller  : use_caller 的调度器，在调用者线程上 drain
+*/
+
+static coServer::Logger::ptr g_logger = COSERVER_LOG_ROOT();
+
+static std::atomic<int> s_done {0};
+static std::atomic<int> s_cancelled {0};
+static int s_bad = 0;
+
+static void short_task(){
+    usleep(1000);
+    ++s_done;
+}
+
+// 一个空闲的长连接：对端不发数据，读一直挂起
+static void keep_alive(int fd){
+    char buf[16];
+    int rt = read(fd, buf, sizeof(buf));
+    if(rt == -1 && errno == ECANCELED){
+        ++s_cancelled;
+    }
+    else{
+        COSERVER_LOG_ERROR(g_logger) << "keep alive read rt=" << rt << " errno=" << errno;
+    }
+    // 截止时间之后再等待 IO 也立即返回 ECANCELED
+    rt = read(fd, buf, sizeof(buf));
+    if(rt == -1 && errno == ECANCELED){
+        ++s_cancelled;
+    }
+}
+
+static void check(bool ok, const char* what){
+    if(!ok){
+        ++s_bad;
+        std::cout << "FAILED: " << what << std::endl;
+    }
+}
+
+static void test_clean(){
+    s_done = 0;
+    coServer::IOManager iom(2, false, "drain_clean");
+    for(int i = 0; i < 100; ++i){
+        iom.schedule(&short_task);
+    }
+    coServer::Scheduler::DrainResult rt = iom.drain(1000);
+    std::cout << "clean   ";
+    rt.dump(std::cout) << std::endl;
+    check(!rt.timedOut, "clean timed out");
+    check(s_done == 100, "clean tasks not done");
+    check(rt.elapsedMs < 1000, "clean waited for deadline");
+}
+
+static void test_timeout(){
+    s_done = 0;
+    s_cancelled = 0;
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    // socketpair 没有 hook，手动登记后读写才会走 IOManager
+    coServer::FdMgr::GetInstance()->get(fds[0], true);
+    coServer::FdMgr::GetInstance()->get(fds[1], true);
+
+    coServer::IOManager iom(2, false, "drain_timeout");
+    int fd = fds[0];
+    iom.schedule([fd](){ keep_alive(fd); });
+    for(int i = 0; i < 100; ++i){
+        iom.schedule(&short_task);
+    }
+    // drain 期间从外部提交的任务被拒绝
+    coServer::Thread submitter([&iom](){
+        usleep(50 * 1000);
+        iom.schedule(&short_task);
+    }, "submitter");
+
+    coServer::Scheduler::DrainResult rt = iom.drain(200);
+    submitter.join();
+    std::cout << "timeout ";
+    rt.dump(std::cout) << std::endl;
+    check(rt.timedOut, "timeout not timed out");
+    check(rt.cancelledFds == 1 && rt.cancelledEvents == 1, "timeout cancelled events");
+    check(rt.rejectedTasks == 1, "timeout rejected tasks");
+    check(s_done == 100, "timeout tasks not done");
+    check(s_cancelled == 2, "timeout read not cancelled");
+    check(rt.elapsedMs >= 200 && rt.elapsedMs < 1000, "timeout elapsed");
+    // 没有 hook 的 close 也会删除句柄上下文，之后复用同一个 fd 时重新登记
+    for(int i = 0; i < 2; ++i){
+        close(fds[i]);
+    }
+}
+
+static void test_caller(){
+    s_done = 0;
+    s_cancelled = 0;
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    coServer::FdMgr::GetInstance()->get(fds[0], true);
+    coServer::FdMgr::GetInstance()->get(fds[1], true);
+
+    coServer::IOManager iom(1, true, "drain_caller");
+    int fd = fds[0];
+    iom.schedule([fd](){ keep_alive(fd); });
+    for(int i = 0; i < 10; ++i){
+        iom.schedule(&short_task);
+    }
+    coServer::Scheduler::DrainResult rt = iom.drain(100);
+    std::cout << "caller  ";
+    rt.dump(std::cout) << std::endl;
+    check(rt.timedOut && rt.cancelledFds == 1, "caller not cancelled");
+    check(s_done == 10, "caller tasks not done");
+    check(s_cancelled == 2, "caller read not cancelled");
+    for(int i = 0; i < 2; ++i){
+        close(fds[i]);
+    }
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    test_clean();
+    test_timeout();
+    test_caller();
+    std::cout << (s_bad ? "FAILED" : "OK") << std::endl;
+    return s_bad ? 1 : 0;
+}
@@ -0,0 +1,171 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+
+#include "src/config.h"
+#include "src/iomanager.h"
+#include "src/log.h"
+#include "src/util.h"
+
+/**
+ *  epoll、epoll 常驻注册（iomanager.epoll_persistent）与 io_uring 后端的回显服务对比
+ *  用法：test_echo_backend [连接数=32] [每个连接的请求数=2000] [线程数=2]
+ *  服务端和客户端在同一个 IOManager 上，客户端每次写 64 字节再读回；
+ *  输出每秒请求数与每个请求的系统调用次数（hook 与 IOManager 发起的，来自调度统计，测试时开启 scheduler.stats）
+*/
+
+static coServer::Logger::ptr g_logger = COSERVER_LOG_ROOT();
+
+static const size_t MSG_SIZE = 64;
+
+static std::atomic<int> s_port {0};
+static std::atomic<int> s_listen_fd {-1};
+static std::atomic<size_t> s_clients_done {0};
+static std::atomic<size_t> s_bad {0};
+
+static void echo_conn(int fd){
+    char buf[MSG_SIZE * 4];
+    while(true){
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if(n <= 0){
+            break;
+        }
+        if(write(fd, buf, n) != n){
+            break;
+        }
+    }
+    close(fd);
+}
+
+static void server(){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = 0;
+    if(bind(fd, (sockaddr*)&addr, sizeof(addr)) || listen(fd, 1024)){
+        COSERVER_LOG_ERROR(g_logger) << "bind/listen errno=" << errno;
+        ++s_bad;
+        return;
+    }
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (sockaddr*)&addr, &len);
+    s_listen_fd = fd;
+    s_port = ntohs(addr.sin_port);
+    while(true){
+        int client = accept(fd, nullptr, nullptr);
+        if(client < 0){
+            // 关闭监听句柄后退出
+            break;
+        }
+        coServer::IOManager::GetThis()->schedule([client](){
+            echo_conn(client);
+        });
+    }
+}
+
+static void client(size_t requests){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = htons(s_port);
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr))){
+        COSERVER_LOG_ERROR(g_logger) << "connect errno=" << errno;
+        ++s_bad;
+        close(fd);
+        ++s_clients_done;
+        return;
+    }
+    char out[MSG_SIZE];
+    char in[MSG_SIZE];
+    for(size_t i = 0; i < requests; ++i){
+        memset(out, 'a' + i % 26, sizeof(out));
+        if(write(fd, out, sizeof(out)) != (ssize_t)sizeof(out)){
+            ++s_bad;
+            break;
+        }
+        size_t got = 0;
+        while(got < sizeof(in)){
+            ssize_t n = read(fd, in + got, sizeof(in) - got);
+            if(n <= 0){
+                break;
+            }
+            got += n;
+        }
+        if(got != sizeof(in) || memcmp(in, out, sizeof(in))){
+            ++s_bad;
+            break;
+        }
+    }
+    close(fd);
+    ++s_clients_done;
+}
+
+static void bench(coServer::IOManager::Backend backend, bool persistent
+        ,size_t conns, size_t requests, size_t threads){
+    coServer::Config::Lookup<bool>("iomanager.epoll_persistent")->setValue(persistent);
+    s_port = 0;
+    s_listen_fd = -1;
+    s_clients_done = 0;
+    coServer::IOManager iom(threads, false, "echo", std::vector<int>(), backend);
+    iom.schedule(&server);
+    while(!s_port && !s_bad){
+        usleep(1000);
+    }
+
+    iom.resetStats();
+    uint64_t begin = coServer::GetCurrentUS();
+    for(size_t i = 0; i < conns; ++i){
+        iom.schedule([requests](){
+            client(requests);
+        });
+    }
+    while(s_clients_done < conns){
+        usleep(1000);
+    }
+    uint64_t used = coServer::GetCurrentUS() - begin;
+
+    coServer::Scheduler::Stats stats;
+    iom.getStats(stats);
+    uint64_t syscalls = 0;
+    for(auto& i : stats.threads){
+        syscalls += i.syscalls;
+    }
+    // 唤醒阻塞在 accept 中的协程，服务端退出后 IOManager 才能停止
+    int fd = s_listen_fd;
+    iom.schedule([fd](){
+        close(fd);
+    });
+
+    double total = conns * requests;
+    std::cout << (iom.isUring() ? "io_uring  " : (iom.isPersistent() ? "epoll(et) " : "epoll     "))
+        << " requests=" << (uint64_t)total
+        << " elapsed=" << used / 1000 << "ms"
+        << " qps=" << (uint64_t)(total * 1000000.0 / used)
+        << " syscalls/req=" << syscalls / total
+        << std::endl;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    coServer::Config::Lookup<bool>("scheduler.stats")->setValue(true);
+    size_t conns = argc > 1 ? atoi(argv[1]) : 32;
+    size_t requests = argc > 2 ? atoi(argv[2]) : 2000;
+    size_t threads = argc > 3 ? atoi(argv[3]) : 2;
+    std::cout << "conns=" << conns << " requests=" << requests << " threads=" << threads << std::endl;
+    bench(coServer::IOManager::BACKEND_EPOLL, false, conns, requests, threads);
+    bench(coServer::IOManager::BACKEND_EPOLL, true, conns, requests, threads);
+    bench(coServer::IOManager::BACKEND_IO_URING, false, conns, requests, threads);
+    std::cout << (s_bad ? "FAILED" : "OK") << std::endl;
+    return s_bad ? 1 : 0;
+}
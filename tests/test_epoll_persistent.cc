@@ -0,0 +1,117 @@
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+
+#include "src/config.h"
+#include "src/fd_manager.h"
+#include "src/hook.h"
+#include "src/iomanager.h"
+#include "src/log.h"
+#include "src/thread.h"
+
+/**
+ *  epoll 常驻注册模式（iomanager.epoll_persistent）下句柄在 IOManager 之外关闭后复用
+ *  句柄先在 IOManager 中等待过一次（已经注册到 epoll），再用下面的方式关闭，内核删除了注册，
+ *  IOManager 的 cancelAll 没有执行；之后新建的句柄复用同一个 fd，等待读事件必须能被唤醒
+ *  nohook : 关闭 hook 的协程中 close
+ *  thread : 没有 IOManager 的线程中 close
+ *  switch : 用 switchTo 切换到另一个 IOManager 后 close
+*/
+
+static coServer::Logger::ptr g_logger = COSERVER_LOG_ROOT();
+
+static std::atomic<bool> s_finished {false};
+static int s_bad = 0;
+
+static void check(bool ok, const std::string& what){
+    if(!ok){
+        ++s_bad;
+        std::cout << "FAILED: " << what << std::endl;
+    }
+}
+
+static void make_pair(int fds[2]){
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    // socketpair 没有 hook，手动登记后读写才会走 IOManager
+    coServer::FdMgr::GetInstance()->get(fds[0], true);
+    coServer::FdMgr::GetInstance()->get(fds[1], true);
+}
+
+// 在 fds[0] 上挂起等待读，另一个协程稍后写入；注册失效时 1 秒后超时返回 false
+static bool wait_readable(int fds[2]){
+    timeval tv = {1, 0};
+    setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int fd = fds[1];
+    coServer::IOManager::GetThis()->schedule([fd](){
+        usleep(10 * 1000);
+        write(fd, "x", 1);
+    });
+    char c;
+    ssize_t n = read(fds[0], &c, 1);
+    if(n != 1){
+        COSERVER_LOG_ERROR(g_logger) << "read rt=" << n << " errno=" << errno;
+    }
+    return n == 1;
+}
+
+static void close_nohook(int fds[2], coServer::IOManager*){
+    coServer::set_hook_enable(false);
+    close(fds[0]);
+    close(fds[1]);
+    coServer::set_hook_enable(true);
+}
+
+static void close_thread(int fds[2], coServer::IOManager*){
+    coServer::Thread thread([fds](){
+        close(fds[0]);
+        close(fds[1]);
+    }, "closer");
+    thread.join();
+}
+
+static void close_switch(int fds[2], coServer::IOManager* other){
+    coServer::IOManager* self = coServer::IOManager::GetThis();
+    other->switchTo();
+    close(fds[0]);
+    close(fds[1]);
+    self->switchTo();
+}
+
+static void test_reuse(const std::string& name, void (*close_fn)(int*, coServer::IOManager*)
+        ,coServer::IOManager* other){
+    int fds[2];
+    make_pair(fds);
+    check(wait_readable(fds), name + " first wait");
+    int old = fds[0];
+    close_fn(fds, other);
+
+    make_pair(fds);
+    check(fds[0] == old, name + " fd not reused");
+    check(wait_readable(fds), name + " wait after reuse");
+    close(fds[0]);
+    close(fds[1]);
+    std::cout << name << " fd=" << old << std::endl;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    coServer::Config::Lookup<bool>("iomanager.epoll_persistent")->setValue(true);
+    {
+        coServer::IOManager iom(1, false, "persistent");
+        coServer::IOManager other(1, false, "other");
+        iom.schedule([&other](){
+            test_reuse("nohook", &close_nohook, &other);
+            test_reuse("thread", &close_thread, &other);
+            test_reuse("switch", &close_switch, &other);
+            s_finished = true;
+        });
+        while(!s_finished){
+            usleep(1000);
+        }
+    }
+    std::cout << (s_bad ? "FAILED" : "OK") << std::endl;
+    return s_bad ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+#include <unistd.h>
+#include <atomic>
+#include <string>
+
+#include "src/fiber.h"
+#include "src/log.h"
+#include "src/macro.h"
+#include "src/scheduler.h"
+
+/**
+ *  协程局部变量测试：
+ *  每个协程的值互不影响，协程通过 switchTo 在线程之间迁移后值不变，
+ *  协程结束和 reset 时调用析构函数
+*/
+
+static coServer::Logger::ptr g_logger = COSERVER_LOG_ROOT();
+
+static std::atomic<int> s_alive {0};
+
+struct RequestContext{
+    RequestContext(const std::string& id)
+        :trace_id(id){
+        ++s_alive;
+    }
+    ~RequestContext(){
+        --s_alive;
+    }
+    std::string trace_id;
+};
+
+static coServer::FiberLocal<RequestContext> s_ctx;
+
+void test_call_back(){
+    coServer::Fiber::GetThis();
+    coServer::Fiber::ptr fibers[2];
+    for(int i = 0; i < 2; ++i){
+        fibers[i].reset(new coServer::Fiber([i](){
+            s_ctx.reset(new RequestContext("trace-" + std::to_string(i)));
+            coServer::Fiber::GetThis()->back();
+            COSERVER_ASSERT(s_ctx->trace_id == "trace-" + std::to_string(i));
+        }, 0, true));
+    }
+    fibers[0]->call();
+    fibers[1]->call();
+    COSERVER_ASSERT(s_alive == 2);
+    COSERVER_ASSERT(!s_ctx.get());
+    fibers[0]->call();
+    fibers[1]->call();
+    // 协程结束时已经析构
+    COSERVER_ASSERT(s_alive == 0);
+
+    // reset 清除还未运行的协程上设置的值
+    fibers[0]->reset([](){});
+    fibers[0]->setLocal(0, new RequestContext("stale"));
+    COSERVER_ASSERT(s_alive == 1);
+    fibers[0]->reset([](){
+        COSERVER_ASSERT(!s_ctx.get());
+    });
+    COSERVER_ASSERT(s_alive == 0);
+    COSERVER_LOG_INFO(g_logger) << "test_call_back ok";
+}
+
+void test_migrate(){
+    std::atomic<int> moved {0};
+    {
+        // 两个单线程调度器，switchTo 一定会让协程换到另一个线程
+        coServer::Scheduler a(1, false, "local_a");
+        coServer::Scheduler b(1, false, "local_b");
+        a.start();
+        b.start();
+        for(int i = 0; i < 100; ++i){
+            a.schedule([i, &a, &b, &moved](){
+                std::string id = "trace-" + std::to_string(i);
+                s_ctx.reset(new RequestContext(id));
+                pid_t tid = coServer::GetThreadId();
+                for(int j = 0; j < 5; ++j){
+                    b.switchTo();
+                    COSERVER_ASSERT(coServer::GetThreadId() != tid);
+                    COSERVER_ASSERT(s_ctx->trace_id == id);
+                    a.switchTo();
+                    COSERVER_ASSERT(coServer::GetThreadId() == tid);
+                    COSERVER_ASSERT(s_ctx->trace_id == id);
+                }
+                ++moved;
+            });
+        }
+        while(moved < 100){
+            usleep(1000);
+        }
+        a.stop();
+        b.stop();
+    }
+    COSERVER_ASSERT(moved == 100);
+    COSERVER_ASSERT(s_alive == 0);
+    COSERVER_LOG_INFO(g_logger) << "test_migrate ok moved=" << moved;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    test_call_back();
+    test_migrate();
+    return 0;
+}
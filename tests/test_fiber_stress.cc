@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+#include <vector>
+
+#include "src/fiber.h"
+#include "src/log.h"
+#include "src/stack_allocator.h"
+#include "src/util.h"
+
+/**
+ *  大量挂起协程的内存测试
+ *  用法：test_fiber_stress [协程数量=1000000] [栈大小=fiber.stack_size] [dedicated|shared]
+ *  每个协程运行到第一次切出后挂起，统计挂起状态下的 RSS；shared 使用共享栈协程
+*/
+
+static size_t GetRss(){
+    FILE* fp = fopen("/proc/self/statm", "r");
+    if(!fp){
+        return 0;
+    }
+    size_t pages = 0, rss = 0;
+    if(fscanf(fp, "%zu %zu", &pages, &rss) != 2){
+        rss = 0;
+    }
+    fclose(fp);
+    return rss * sysconf(_SC_PAGESIZE);
+}
+
+static size_t GetMaxMapCount(){
+    FILE* fp = fopen("/proc/sys/vm/max_map_count", "r");
+    if(!fp){
+        return 0;
+    }
+    size_t count = 0;
+    if(fscanf(fp, "%zu", &count) != 1){
+        count = 0;
+    }
+    fclose(fp);
+    return count;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    size_t count = argc > 1 ? atoll(argv[1]) : 1000000;
+    size_t stack_size = argc > 2 ? atoll(argv[2]) : 0;
+    bool shared_stack = argc > 3 && std::string(argv[3]) == "shared";
+
+    // 每个带保护页的栈占两个内存映射，超过 vm.max_map_count 后分配器退回到没有保护页的栈
+    size_t max_map_count = GetMaxMapCount();
+    if(max_map_count && count * 2 + 1000 > max_map_count){
+        std::cout << "vm.max_map_count=" << max_map_count
+            << ", stacks beyond the limit have no guard page" << std::endl;
+    }
+
+    coServer::Fiber::GetThis();
+    std::vector<coServer::Fiber::ptr> fibers;
+    fibers.reserve(count);
+
+    size_t rss_begin = GetRss();
+    uint64_t begin = coServer::GetCurrentMS();
+    for(size_t i = 0; i < count; ++i){
+        coServer::Fiber::ptr fiber(new coServer::Fiber([](){
+            coServer::Fiber::GetThis()->back();
+        }, stack_size, true, shared_stack));
+        fiber->call();
+        fibers.push_back(fiber);
+    }
+    uint64_t create_ms = coServer::GetCurrentMS() - begin;
+    size_t rss_parked = GetRss();
+
+    std::cout << (shared_stack ? "shared" : "dedicated")
+        << " fibers=" << count
+        << " create=" << create_ms << "ms"
+        << " rss_before=" << rss_begin / 1024 << "KiB"
+        << " rss_parked=" << rss_parked / 1024 << "KiB"
+        << " per_fiber=" << (rss_parked - rss_begin) / (double)count << "B"
+        << std::endl;
+
+    begin = coServer::GetCurrentMS();
+    for(auto& i : fibers){
+        i->call();
+    }
+    fibers.clear();
+    std::cout << "resume+destroy=" << coServer::GetCurrentMS() - begin << "ms"
+        << " rss_after=" << GetRss() / 1024 << "KiB"
+        << " stack_hits=" << coServer::StackAllocator::GetHits()
+        << " stack_misses=" << coServer::StackAllocator::GetMisses()
+        << " unguarded=" << coServer::StackAllocator::GetUnguarded()
+        << std::endl;
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <ucontext.h>
+#include <stdlib.h>
+#include <iostream>
+
+#include "src/fiber.h"
+#include "src/fiber_context.h"
+#include "src/log.h"
+#include "src/util.h"
+
+/**
+ *  协程切换开销测试：
+ *  ucontext  - glibc swapcontext（每次切换都有 rt_sigprocmask 系统调用）
+ *  context   - 当前编译选择的 FiberContext 实现
+ *  fiber     - Fiber::call / back 完整路径
+ *  pair      - 两个协程交替运行，对比独立栈与共享栈（每次切入都要拷贝栈）
+*/
+
+static uint64_t s_rounds = 1000000;
+
+static ucontext_t s_uc_main;
+static ucontext_t s_uc_fiber;
+
+static void uc_func(){
+    while(true){
+        swapcontext(&s_uc_fiber, &s_uc_main);
+    }
+}
+
+static void bench_ucontext(){
+    size_t size = 128 * 1024;
+    void* stack = malloc(size);
+    getcontext(&s_uc_fiber);
+    s_uc_fiber.uc_link = nullptr;
+    s_uc_fiber.uc_stack.ss_sp = stack;
+    s_uc_fiber.uc_stack.ss_size = size;
+    makecontext(&s_uc_fiber, &uc_func, 0);
+
+    uint64_t begin = coServer::GetCurrentUS();
+    for(uint64_t i = 0; i < s_rounds; ++i){
+        swapcontext(&s_uc_main, &s_uc_fiber);
+    }
+    uint64_t used = coServer::GetCurrentUS() - begin;
+    std::cout << "ucontext: " << used * 1000.0 / (s_rounds * 2) << " ns/switch" << std::endl;
+    free(stack);
+}
+
+static coServer::FiberContext s_ctx_main;
+static coServer::FiberContext s_ctx_fiber;
+
+static void ctx_func(){
+    while(true){
+        coServer::SwapFiberContext(&s_ctx_fiber, &s_ctx_main);
+    }
+}
+
+static void bench_context(){
+    size_t size = 128 * 1024;
+    void* stack = malloc(size);
+    coServer::InitFiberContext(&s_ctx_main);
+    coServer::MakeFiberContext(&s_ctx_fiber, stack, size, &ctx_func);
+
+    uint64_t begin = coServer::GetCurrentUS();
+    for(uint64_t i = 0; i < s_rounds; ++i){
+        coServer::SwapFiberContext(&s_ctx_main, &s_ctx_fiber);
+    }
+    uint64_t used = coServer::GetCurrentUS() - begin;
+    std::cout << "context(" << coServer::FiberContextImpl() << "): "
+        << used * 1000.0 / (s_rounds * 2) << " ns/switch" << std::endl;
+    free(stack);
+}
+
+static void bench_fiber(){
+    coServer::Fiber::GetThis();
+    coServer::Fiber* raw = nullptr;
+    coServer::Fiber::ptr fiber(new coServer::Fiber([&raw](){
+        for(uint64_t i = 0; i < s_rounds; ++i){
+            raw->back();
+        }
+    }, 0, true));
+    raw = fiber.get();
+
+    uint64_t begin = coServer::GetCurrentUS();
+    for(uint64_t i = 0; i < s_rounds; ++i){
+        fiber->call();
+    }
+    uint64_t used = coServer::GetCurrentUS() - begin;
+    fiber->call();
+    std::cout << "fiber(" << coServer::FiberContextImpl() << "): "
+        << used * 1000.0 / (s_rounds * 2) << " ns/switch" << std::endl;
+}
+
+static void bench_pair(bool shared_stack){
+    coServer::Fiber::GetThis();
+    coServer::Fiber::ptr fibers[2];
+    for(auto& i : fibers){
+        i.reset(new coServer::Fiber([](){
+            for(uint64_t i = 0; i < s_rounds; ++i){
+                coServer::Fiber::GetThis()->back();
+            }
+        }, 0, true, shared_stack));
+    }
+
+    uint64_t begin = coServer::GetCurrentUS();
+    for(uint64_t i = 0; i < s_rounds; ++i){
+        fibers[0]->call();
+        fibers[1]->call();
+    }
+    uint64_t used = coServer::GetCurrentUS() - begin;
+    fibers[0]->call();
+    fibers[1]->call();
+    std::cout << "pair(" << (shared_stack ? "shared" : "dedicated") << "): "
+        << used * 1000.0 / (s_rounds * 4) << " ns/switch";
+    if(shared_stack){
+        std::cout << " saved_stack=" << fibers[0]->getSavedStackSize() << "B";
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    if(argc > 1){
+        s_rounds = atoll(argv[1]);
+    }
+    bench_ucontext();
+    bench_context();
+    bench_fiber();
+    bench_pair(false);
+    bench_pair(true);
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include <sched.h>
+#include <stdlib.h>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "src/fiber.h"
+#include "src/log.h"
+#include "src/scheduler.h"
+#include "src/util.h"
+
+/**
+ *  多线程调度下每次 YieldToReady 的开销
+ *  用法：test_fiber_yield [线程数=4] [协程数=64] [每个协程的切换次数=20000]
+ *  shared : 每次切出前按旧的写法用 GetThis 持有当前协程，切回后释放（两次原子操作）
+ *  raw    : 直接 YieldToReady，内部使用 GetThisRaw
+ *  hold   : 挂起（YieldToHold）后没有其他持有者的协程泄漏而不是在 HOLD 状态析构；
+ *           被唤醒的协程结束后正常释放
+*/
+
+static std::atomic<uint64_t> s_done {0};
+
+static double bench(size_t threads, size_t fibers, uint64_t rounds, bool shared){
+    s_done = 0;
+    uint64_t begin = coServer::GetCurrentUS();
+    {
+        coServer::Scheduler sc(threads, false, shared ? "shared" : "raw");
+        for(size_t i = 0; i < fibers; ++i){
+            sc.schedule([rounds, shared](){
+                for(uint64_t j = 0; j < rounds; ++j){
+                    if(shared){
+                        coServer::Fiber::ptr cur = coServer::Fiber::GetThis();
+                        coServer::Fiber::YieldToReady();
+                    }
+                    else{
+                        coServer::Fiber::YieldToReady();
+                    }
+                }
+                ++s_done;
+            });
+        }
+        sc.start();
+        sc.stop();
+    }
+    uint64_t used = coServer::GetCurrentUS() - begin;
+    return used * 1000.0 / (fibers * rounds);
+}
+
+// 等待协程被调度器设置为 HOLD
+static void wait_hold(const std::weak_ptr<coServer::Fiber>& weak){
+    while(true){
+        coServer::Fiber::ptr fiber = weak.lock();
+        if(fiber && fiber->getState() == coServer::Fiber::HOLD){
+            return;
+        }
+        sched_yield();
+    }
+}
+
+static bool test_hold(){
+    std::atomic<int> steps {0};
+    std::weak_ptr<coServer::Fiber> orphan;
+    std::weak_ptr<coServer::Fiber> woken;
+    {
+        coServer::Scheduler sc(1, false, "hold");
+        sc.start();
+        // 回调任务的协程挂起，没有登记到任何地方
+        sc.schedule([&steps, &orphan](){
+            orphan = coServer::Fiber::GetThis();
+            ++steps;
+            coServer::Fiber::YieldToHold();
+            ++steps;
+        });
+        // 协程任务挂起，调度方没有保留引用，之后通过 weak_ptr 唤醒
+        coServer::Fiber::ptr fiber(new coServer::Fiber([&steps](){
+            ++steps;
+            coServer::Fiber::YieldToHold();
+            ++steps;
+        }));
+        woken = fiber;
+        sc.schedule(std::move(fiber));
+        while(steps < 2){
+            sched_yield();
+        }
+        wait_hold(orphan);
+        wait_hold(woken);
+        sc.schedule(woken.lock());
+        sc.stop();
+    }
+    coServer::Fiber::ptr leaked = orphan.lock();
+    bool ok = steps == 3 && woken.expired()
+        && leaked && leaked->getState() == coServer::Fiber::HOLD;
+    std::cout << "hold: steps=" << steps << " woken_freed=" << woken.expired()
+        << " orphan_alive=" << (bool)leaked << (ok ? " OK" : " FAILED") << std::endl;
+    return ok;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    size_t threads = argc > 1 ? atoi(argv[1]) : 4;
+    size_t fibers = argc > 2 ? atoi(argv[2]) : 64;
+    uint64_t rounds = argc > 3 ? atoll(argv[3]) : 20000;
+
+    if(!test_hold()){
+        return 1;
+    }
+    double shared = bench(threads, fibers, rounds, true);
+    double raw = bench(threads, fibers, rounds, false);
+    std::cout << "threads=" << threads << " fibers=" << fibers << " rounds=" << rounds << std::endl
+        << "shared: " << shared << " ns/yield" << std::endl
+        << "raw:    " << raw << " ns/yield" << std::endl;
+    return 0;
+}
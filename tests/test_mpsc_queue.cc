@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <atomic>
+#include <iostream>
+#include <list>
+#include <vector>
+
+#include "src/log.h"
+#include "src/mpsc_queue.h"
+#include "src/mutex.h"
+#include "src/thread.h"
+#include "src/util.h"
+
+/**
+ *  跨线程提交任务的队列对比：侵入式无锁 MpscQueue 与 Mutex + std::list
+ *  用法：test_mpsc_queue [每个生产者的节点数=200000]
+ *  分别用 1、4、16 个生产者线程入队，一个消费者线程出队，统计每秒入队的节点数
+*/
+
+struct Node{
+    std::atomic<Node*> next = {nullptr};
+    uint64_t value = 0;
+};
+
+class MutexListQueue{
+public:
+    void push(Node* node){
+        coServer::Mutex::Lock lock(m_mutex);
+        m_list.push_back(node);
+    }
+
+    Node* pop(){
+        coServer::Mutex::Lock lock(m_mutex);
+        if(m_list.empty()){
+            return nullptr;
+        }
+        Node* node = m_list.front();
+        m_list.pop_front();
+        return node;
+    }
+private:
+    coServer::Mutex m_mutex;
+    std::list<Node*> m_list;
+};
+
+template<class Queue>
+static double bench(size_t producers, uint64_t per_producer){
+    Queue queue;
+    std::vector<Node> nodes(producers * per_producer);
+    uint64_t total = nodes.size();
+    std::atomic<bool> go {false};
+    uint64_t sum = 0;
+
+    coServer::Thread::ptr consumer(new coServer::Thread([&](){
+        uint64_t got = 0;
+        while(got < total){
+            Node* node = queue.pop();
+            if(node){
+                sum += node->value;
+                ++got;
+            }
+        }
+    }, "consumer"));
+
+    std::vector<coServer::Thread::ptr> thrs;
+    for(size_t i = 0; i < producers; ++i){
+        thrs.push_back(coServer::Thread::ptr(new coServer::Thread([&, i](){
+            while(!go){
+            }
+            Node* begin = &nodes[i * per_producer];
+            for(uint64_t j = 0; j < per_producer; ++j){
+                begin[j].value = j;
+                queue.push(&begin[j]);
+            }
+        }, "producer_" + std::to_string(i))));
+    }
+
+    uint64_t begin = coServer::GetCurrentUS();
+    go = true;
+    for(auto& i : thrs){
+        i->join();
+    }
+    consumer->join();
+    uint64_t used = coServer::GetCurrentUS() - begin;
+    if(sum != producers * (per_producer * (per_producer - 1) / 2)){
+        std::cout << "checksum mismatch sum=" << sum << std::endl;
+    }
+    return total * 1000000.0 / used;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    uint64_t per_producer = argc > 1 ? atoll(argv[1]) : 200000;
+    size_t producers[] = {1, 4, 16};
+    for(auto p : producers){
+        double mpsc = bench<coServer::MpscQueue<Node> >(p, per_producer);
+        double mutex = bench<MutexListQueue>(p, per_producer);
+        std::cout << "producers=" << p
+            << " mpsc=" << (uint64_t)mpsc << " ops/s"
+            << " mutex+list=" << (uint64_t)mutex << " ops/s" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+
+#include "src/histogram.h"
+#include "src/iomanager.h"
+#include "src/log.h"
+#include "src/offload.h"
+#include "src/util.h"
+
+/**
+ *  阻塞调用卸载
+ *  用法：test_offload [阻塞任务数=64] [每个任务阻塞时间ms=20]
+ *  在 2 个线程的 IOManager 中同时提交阻塞任务和 1ms 间隔的心跳定时器：
+ *  inline  : 直接在协程中调用阻塞函数（模拟读普通文件、第三方阻塞库），心跳被卡住
+ *  offload : 通过 coServer::offload 交给卸载线程池，心跳延迟不受影响
+ *  另外检查返回值与异常是否传回调用的协程
+*/
+
+static std::atomic<int> s_done {0};
+
+// 阻塞当前线程，直接发起系统调用绕过 hook，模拟慢磁盘
+static int blocking_call(int ms, int v){
+    struct timespec ts = {ms / 1000, (ms % 1000) * 1000000L};
+    syscall(SYS_nanosleep, &ts, nullptr);
+    return v;
+}
+
+static void bench(bool use_offload, int tasks, int ms){
+    s_done = 0;
+    coServer::Histogram heartbeat;
+    uint64_t begin = coServer::GetCurrentMS();
+    {
+        coServer::IOManager iom(2, false, use_offload ? "offload" : "inline");
+        uint64_t last = coServer::GetCurrentUS();
+        coServer::Timer::ptr timer = iom.addTimer(1, [&heartbeat, &last](){
+            uint64_t now = coServer::GetCurrentUS();
+            heartbeat.record(now - last);
+            last = now;
+        }, true);
+        for(int i = 0; i < tasks; ++i){
+            iom.schedule([use_offload, ms, i](){
+                int v = use_offload ? coServer::offload([ms, i](){return blocking_call(ms, i);})
+                    : blocking_call(ms, i);
+                if(v == i){
+                    ++s_done;
+                }
+            });
+        }
+        while(s_done < tasks){
+            usleep(1000);
+        }
+        timer->cancel();
+    }
+    std::cout << (use_offload ? "offload" : "inline ") << " tasks=" << s_done
+        << " elapsed=" << coServer::GetCurrentMS() - begin << "ms heartbeat(1ms) ";
+    heartbeat.dump(std::cout, "us");
+}
+
+static void check_exception(){
+    coServer::IOManager iom(1, false, "except");
+    iom.schedule([](){
+        try{
+            coServer::offload([](){
+                throw std::runtime_error("disk error");
+            });
+            std::cout << "exception: not thrown" << std::endl;
+        }catch(std::runtime_error& ex){
+            std::cout << "exception: " << ex.what() << std::endl;
+        }
+    });
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    int tasks = argc > 1 ? atoi(argv[1]) : 64;
+    int ms = argc > 2 ? atoi(argv[2]) : 20;
+    bench(false, tasks, ms);
+    bench(true, tasks, ms);
+    check_exception();
+    // 普通线程中调用时阻塞等待
+    std::cout << "plain thread: " << coServer::offload([](){return blocking_call(1, 42);}) << std::endl;
+    coServer::OffloadPool::GetDefault()->dump(std::cout);
+    return 0;
+}
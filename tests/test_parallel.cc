@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "src/log.h"
+#include "src/parallel.h"
+#include "src/scheduler.h"
+#include "src/util.h"
+
+/**
+ *  并行循环与 fork/join 的扩展性
+ *  用法：test_parallel [数据块数=4096] [块大小=4096]
+ *  对每个数据块计算 FNV-1a 哈希（CPU 密集），分别用 1/2/4/8 个线程：
+ *  for    : ParallelFor 计算每个块的哈希
+ *  reduce : ParallelReduce 计算所有块哈希的异或
+ *  group  : TaskGroup 递归二分（fork/join），等待的协程挂起而不是阻塞线程
+ *  输出相对单线程顺序执行的加速比，并检查结果一致
+*/
+
+static uint64_t Fnv1a(const uint8_t* data, size_t len){
+    uint64_t h = 14695981039346656037ull;
+    for(size_t i = 0; i < len; ++i){
+        h ^= data[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static std::vector<uint8_t> s_data;
+static size_t s_blocks = 4096;
+static size_t s_block_size = 4096;
+
+static uint64_t HashBlock(size_t i){
+    return Fnv1a(&s_data[i * s_block_size], s_block_size);
+}
+
+static uint64_t GroupXor(size_t begin, size_t end){
+    if(end - begin <= 16){
+        uint64_t rt = 0;
+        for(size_t i = begin; i < end; ++i){
+            rt ^= HashBlock(i);
+        }
+        return rt;
+    }
+    size_t mid = begin + (end - begin) / 2;
+    std::shared_ptr<uint64_t> left(new uint64_t(0));
+    coServer::TaskGroup group;
+    group.run([left, begin, mid](){
+        *left = GroupXor(begin, mid);
+    });
+    uint64_t right = GroupXor(mid, end);
+    group.wait();
+    return *left ^ right;
+}
+
+// 在调度器的协程中执行 fn，返回耗时（微秒）
+template<class F>
+static uint64_t RunIn(size_t threads, F fn){
+    uint64_t used = 0;
+    coServer::Scheduler sc(threads, false, "parallel");
+    sc.start();
+    std::atomic<bool> done {false};
+    sc.schedule([&](){
+        uint64_t begin = coServer::GetCurrentUS();
+        fn();
+        used = coServer::GetCurrentUS() - begin;
+        done = true;
+    });
+    sc.stop();
+    return done ? used : 0;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    if(argc > 1){
+        s_blocks = atoi(argv[1]);
+    }
+    if(argc > 2){
+        s_block_size = atoi(argv[2]);
+    }
+    s_data.resize(s_blocks * s_block_size);
+    for(size_t i = 0; i < s_data.size(); ++i){
+        s_data[i] = (uint8_t)(i * 2654435761u >> 13);
+    }
+
+    std::vector<uint64_t> expect(s_blocks);
+    uint64_t expect_xor = 0;
+    uint64_t begin = coServer::GetCurrentUS();
+    for(size_t i = 0; i < s_blocks; ++i){
+        expect[i] = HashBlock(i);
+        expect_xor ^= expect[i];
+    }
+    uint64_t serial = coServer::GetCurrentUS() - begin;
+    std::cout << "blocks=" << s_blocks << " block_size=" << s_block_size
+        << " serial=" << serial << "us" << std::endl;
+
+    size_t thread_counts[] = {1, 2, 4, 8};
+    for(size_t threads : thread_counts){
+        std::vector<uint64_t> hashes(s_blocks);
+        uint64_t t_for = RunIn(threads, [&](){
+            coServer::ParallelFor(nullptr, (size_t)0, s_blocks, [&hashes](size_t i){
+                hashes[i] = HashBlock(i);
+            });
+        });
+        bool ok_for = hashes == expect;
+
+        uint64_t result = 0;
+        uint64_t t_reduce = RunIn(threads, [&](){
+            result = coServer::ParallelReduce(nullptr, (size_t)0, s_blocks, (uint64_t)0
+                    ,[](size_t i){return HashBlock(i);}
+                    ,[](uint64_t a, uint64_t b){return a ^ b;});
+        });
+        bool ok_reduce = result == expect_xor;
+
+        uint64_t group_result = 0;
+        uint64_t t_group = RunIn(threads, [&](){
+            group_result = GroupXor(0, s_blocks);
+        });
+        bool ok_group = group_result == expect_xor;
+
+        std::cout << "threads=" << threads
+            << " for=" << t_for << "us(x" << serial * 1.0 / t_for << (ok_for ? "" : " WRONG") << ")"
+            << " reduce=" << t_reduce << "us(x" << serial * 1.0 / t_reduce << (ok_reduce ? "" : " WRONG") << ")"
+            << " group=" << t_group << "us(x" << serial * 1.0 / t_group << (ok_group ? "" : " WRONG") << ")"
+            << std::endl;
+    }
+
+    // 任务中的异常在 wait 中重新抛出
+    RunIn(2, [](){
+        coServer::TaskGroup group;
+        group.run([](){
+            throw std::runtime_error("task failed");
+        });
+        try{
+            group.wait();
+            std::cout << "exception: not thrown" << std::endl;
+        }catch(std::runtime_error& ex){
+            std::cout << "exception: " << ex.what() << std::endl;
+        }
+    });
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include <sched.h>
+#include <stdlib.h>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <new>
+
+#include "src/log.h"
+#include "src/scheduler.h"
+
+/**
+ *  每个调度任务的堆内存申请次数
+ *  std::function : 按改动前的路径模拟，std::function 任务经过 schedule 传参、链表节点、
+ *                  取出任务、Fiber::reset 传参和赋值，每一步都拷贝一次
+ *  SmallCallable : 实际的 Scheduler::schedule 与执行过程
+ *  任务捕获 48 字节，超过 std::function 的内部缓冲区
+ *  fiber wakeup  : 其他线程反复 schedule(fiber) 唤醒挂起的协程（事件、定时器的唤醒路径），
+ *                  任务节点复用协程自带的节点，第一次之后不申请内存
+*/
+
+static std::atomic<uint64_t> s_allocs {0};
+
+void* operator new(size_t size){
+    ++s_allocs;
+    void* p = malloc(size ? size : 1);
+    if(!p){
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept{
+    free(p);
+}
+
+static const int N = 10000;
+static std::atomic<uint64_t> s_sum {0};
+
+struct Capture{
+    uint64_t v[6];
+};
+
+struct LegacyTask{
+    std::function<void()> cb;
+    int thread;
+};
+
+static void legacy_reset(std::function<void()>& m_cb, std::function<void()> cb){
+    m_cb = cb;
+}
+
+static double bench_std_function(){
+    std::list<LegacyTask> tasks;
+    std::function<void()> m_cb;
+    uint64_t begin = s_allocs;
+    for(int i = 0; i < N; ++i){
+        Capture c = {{(uint64_t)i, 1, 2, 3, 4, 5}};
+        std::function<void()> fc = [c](){ s_sum += c.v[0]; };
+        LegacyTask ft{fc, -1};
+        tasks.push_back(ft);
+    }
+    while(!tasks.empty()){
+        LegacyTask ft = tasks.front();
+        tasks.pop_front();
+        legacy_reset(m_cb, ft.cb);
+        m_cb();
+    }
+    return (s_allocs - begin) / (double)N;
+}
+
+static void bench_small_callable(double& schedule_allocs, double& run_allocs){
+    coServer::Scheduler sc(1, false, "alloc");
+    uint64_t begin = s_allocs;
+    for(int i = 0; i < N; ++i){
+        Capture c = {{(uint64_t)i, 1, 2, 3, 4, 5}};
+        sc.schedule([c](){ s_sum += c.v[0]; });
+    }
+    schedule_allocs = (s_allocs - begin) / (double)N;
+    begin = s_allocs;
+    sc.start();
+    sc.stop();
+    run_allocs = (s_allocs - begin) / (double)N;
+}
+
+static double bench_fiber_wakeup(){
+    coServer::Scheduler sc(1, false, "wakeup");
+    sc.start();
+    std::atomic<int> parked {0};
+    coServer::Fiber::ptr fiber(new coServer::Fiber([&parked](){
+        for(int i = 0; i <= N; ++i){
+            ++parked;
+            coServer::Fiber::YieldToHold();
+        }
+    }));
+    sc.schedule(fiber);
+    uint64_t begin = 0;
+    for(int i = 0; i <= N; ++i){
+        // 等协程挂起后再从外部线程唤醒
+        while(parked <= i || fiber->getState() != coServer::Fiber::HOLD){
+            sched_yield();
+        }
+        if(i == 0){
+            // 第一次唤醒创建节点，不计入
+            sc.schedule(fiber);
+            begin = s_allocs;
+            continue;
+        }
+        sc.schedule(fiber);
+    }
+    uint64_t allocs = s_allocs - begin;
+    sc.stop();
+    return allocs / (double)N;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    double before = bench_std_function();
+    double schedule_allocs = 0, run_allocs = 0;
+    bench_small_callable(schedule_allocs, run_allocs);
+    std::cout << "std::function: " << before << " allocs/task" << std::endl;
+    std::cout << "SmallCallable: " << schedule_allocs << " allocs/task on schedule, "
+        << run_allocs << " allocs/task on run (including thread start and fiber pool warm-up)"
+        << std::endl;
+    std::cout << "fiber wakeup: " << bench_fiber_wakeup() << " allocs/wakeup" << std::endl;
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <atomic>
+#include <iostream>
+
+#include "src/config.h"
+#include "src/histogram.h"
+#include "src/log.h"
+#include "src/scheduler.h"
+#include "src/util.h"
+
+/**
+ *  空闲调度器的 CPU 占用与唤醒延迟
+ *  用法：test_scheduler_idle [线程数=4] [唤醒次数=200]
+ *  分别使用不同的 scheduler.idle_spin_us：
+ *  idle_cpu : 没有任务时所有线程的 CPU 占用（占单核的百分比）
+ *  parked   : 线程已经停放后提交任务，从 schedule 到任务开始执行的延迟
+ *  spinning : 连续提交任务（间隔小于自旋时间），线程还在自旋时的延迟
+*/
+
+static uint64_t GetCpuUS(){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ull
+        + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+// 每次提交一个任务并等待它执行完，记录唤醒延迟
+static void measure_wake(coServer::Scheduler& sc, coServer::Histogram& hist
+        ,uint64_t rounds, uint64_t interval_us){
+    for(uint64_t i = 0; i < rounds; ++i){
+        usleep(interval_us);
+        std::atomic<bool> done {false};
+        uint64_t begin = coServer::GetCurrentUS();
+        sc.schedule([&hist, &done, begin](){
+            hist.record(coServer::GetCurrentUS() - begin);
+            done = true;
+        });
+        while(!done){
+            sched_yield();
+        }
+    }
+}
+
+static void bench(size_t threads, uint64_t rounds, uint32_t spin_us){
+    coServer::Config::Lookup<uint32_t>("scheduler.idle_spin_us", 50)->setValue(spin_us);
+    coServer::Scheduler sc(threads, false, "idle");
+    sc.start();
+    // 等所有线程进入空闲
+    usleep(100 * 1000);
+
+    uint64_t cpu_begin = GetCpuUS();
+    uint64_t begin = coServer::GetCurrentUS();
+    usleep(500 * 1000);
+    double idle_cpu = (GetCpuUS() - cpu_begin) * 100.0 / (coServer::GetCurrentUS() - begin);
+
+    coServer::Histogram parked;
+    measure_wake(sc, parked, rounds, 2000 + spin_us);
+    coServer::Histogram spinning;
+    measure_wake(sc, spinning, rounds, spin_us / 4);
+
+    std::cout << "spin=" << spin_us << "us"
+        << " idle_cpu=" << idle_cpu << "%"
+        << " parked p50=" << parked.percentile(0.5) << "us p99=" << parked.percentile(0.99) << "us"
+        << " spinning p50=" << spinning.percentile(0.5) << "us p99=" << spinning.percentile(0.99) << "us"
+        << " wakeups=" << sc.getWakeups()
+        << " spurious=" << sc.getSpuriousWakeups()
+        << std::endl;
+    sc.stop();
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    size_t threads = argc > 1 ? atoi(argv[1]) : 4;
+    uint64_t rounds = argc > 2 ? atoll(argv[2]) : 200;
+    std::cout << "threads=" << threads << " rounds=" << rounds << std::endl;
+    uint32_t spins[] = {0, 50, 500};
+    for(auto i : spins){
+        bench(threads, rounds, i);
+    }
+    return 0;
+}
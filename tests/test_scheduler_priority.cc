@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+
+#include "src/histogram.h"
+#include "src/log.h"
+#include "src/scheduler.h"
+#include "src/util.h"
+
+/**
+ *  后台任务占满线程池时前台任务的调度延迟
+ *  用法：test_scheduler_priority [线程数=4] [前台任务数=1000]
+ *  每个后台任务忙等约 200us 后重新提交自己，保证队列里一直有大量后台任务；
+ *  主线程每毫秒提交一个前台任务，统计从提交到开始执行的延迟
+ *  fifo     : 前台、后台任务都是 NORMAL
+ *  priority : 前台任务 HIGH，后台任务 BACKGROUND
+*/
+
+static std::atomic<bool> s_running {false};
+static std::atomic<uint64_t> s_background_done {0};
+
+static void spin_us(uint64_t us){
+    uint64_t end = coServer::GetCurrentUS() + us;
+    while(coServer::GetCurrentUS() < end);
+}
+
+static void background(bool use_priority){
+    spin_us(200);
+    ++s_background_done;
+    if(!s_running){
+        return;
+    }
+    coServer::Scheduler* sc = coServer::Scheduler::GetThis();
+    if(use_priority){
+        sc->schedule([](){ background(true); }, coServer::Scheduler::BACKGROUND);
+    }
+    else{
+        sc->schedule([](){ background(false); });
+    }
+}
+
+static void bench(size_t threads, uint64_t count, bool use_priority){
+    s_running = true;
+    s_background_done = 0;
+    coServer::Scheduler sc(threads, false, "prio");
+    sc.start();
+    for(size_t i = 0; i < threads * 64; ++i){
+        if(use_priority){
+            sc.schedule([](){ background(true); }, coServer::Scheduler::BACKGROUND);
+        }
+        else{
+            sc.schedule([](){ background(false); });
+        }
+    }
+    // 等后台任务占满线程池
+    usleep(100 * 1000);
+
+    coServer::Histogram latency;
+    std::atomic<uint64_t> done {0};
+    uint64_t begin = coServer::GetCurrentUS();
+    uint64_t background_begin = s_background_done;
+    for(uint64_t i = 0; i < count; ++i){
+        uint64_t submit = coServer::GetCurrentUS();
+        auto fn = [&latency, &done, submit](){
+            latency.record(coServer::GetCurrentUS() - submit);
+            ++done;
+        };
+        if(use_priority){
+            sc.schedule(fn, coServer::Scheduler::HIGH);
+        }
+        else{
+            sc.schedule(fn);
+        }
+        usleep(1000);
+    }
+    while(done < count){
+        usleep(1000);
+    }
+    uint64_t used = coServer::GetCurrentUS() - begin;
+    uint64_t background_done = s_background_done - background_begin;
+    s_running = false;
+    sc.stop();
+
+    std::cout << (use_priority ? "priority" : "fifo    ")
+        << " foreground p50=" << latency.percentile(0.5) << "us"
+        << " p99=" << latency.percentile(0.99) << "us"
+        << " max=" << latency.getMax() << "us"
+        << " background=" << background_done * 1000000.0 / used << " tasks/s"
+        << std::endl;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    size_t threads = argc > 1 ? atoi(argv[1]) : 4;
+    uint64_t count = argc > 2 ? atoll(argv[2]) : 1000;
+    std::cout << "threads=" << threads << " foreground=" << count << std::endl;
+    bench(threads, count, false);
+    bench(threads, count, true);
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+#include <map>
+
+#include "src/config.h"
+#include "src/iomanager.h"
+#include "src/log.h"
+#include "src/scheduler.h"
+#include "src/util.h"
+
+/**
+ *  运行中调整线程数
+ *  用法：test_scheduler_resize [每轮任务数=3000] [轮数=6]
+ *  每轮提交一批任务后通过 scheduler.threads 配置在 1~3 个线程之间切换，
+ *  任务多次把自己指定回当前线程（其中一部分使用共享栈），检查线程退休后任务没有丢失
+*/
+
+static std::atomic<uint64_t> s_done {0};
+
+static void run(coServer::Scheduler* sc, const std::string& name, int tasks, int rounds){
+    s_done = 0;
+    uint64_t total = 0;
+    sc->start();
+    uint64_t begin = coServer::GetCurrentMS();
+    for(int round = 0; round < rounds; ++round){
+        for(int i = 0; i < tasks; ++i){
+            sc->schedule([sc](){
+                for(int k = 0; k < 3; ++k){
+                    sc->schedule(coServer::Fiber::GetThis(), coServer::GetThreadId());
+                    coServer::Fiber::YieldToHold();
+                }
+                ++s_done;
+            }, -1, i % 3 == 0);
+            ++total;
+        }
+        std::map<std::string, uint32_t> threads;
+        threads[name] = round % 3 + 1;
+        coServer::Config::Lookup<std::map<std::string, uint32_t> >("scheduler.threads")->setValue(threads);
+        usleep(20000);
+    }
+    sc->stop();
+    std::cout << name << " done=" << s_done << "/" << total
+        << " threads=" << sc->getThreadCount()
+        << " elapsed=" << coServer::GetCurrentMS() - begin << "ms"
+        << (s_done == total ? "" : " LOST") << std::endl;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    int tasks = argc > 1 ? atoi(argv[1]) : 3000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 6;
+    {
+        coServer::Scheduler sc(2, false, "resize_sc");
+        run(&sc, "resize_sc", tasks, rounds);
+    }
+    {
+        coServer::IOManager iom(2, false, "resize_io");
+        run(&iom, "resize_io", tasks, rounds);
+    }
+    return 0;
+}
@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+#include <memory>
+
+#include "src/config.h"
+#include "src/fiber.h"
+#include "src/histogram.h"
+#include "src/log.h"
+#include "src/scheduler.h"
+#include "src/util.h"
+
+/**
+ *  后台任务占满线程时，两个协程互相唤醒（ping-pong）的往返延迟
+ *  用法：test_scheduler_run_next [后台任务数=64] [往返次数=500]
+ *  单个工作线程，每个后台任务忙等约 20us 后重新提交自己，队列里一直有大量后台任务；
+ *  协程在运行中唤醒对方，没有 runNext 时对方排在所有后台任务之后，有 runNext 时当前协程切出后马上执行
+ *  off : scheduler.run_next_limit = 0
+ *  on  : scheduler.run_next_limit = 8（默认值）
+*/
+
+static std::atomic<bool> s_running {false};
+static std::atomic<uint64_t> s_background_done {0};
+
+static void spin_us(uint64_t us){
+    uint64_t end = coServer::GetCurrentUS() + us;
+    while(coServer::GetCurrentUS() < end);
+}
+
+static void background(){
+    spin_us(20);
+    ++s_background_done;
+    if(s_running){
+        coServer::Scheduler::GetThis()->schedule(&background);
+    }
+}
+
+// 两个协程共享的状态，放在堆上
+struct PingPong{
+    coServer::Fiber::ptr ping;
+    coServer::Fiber::ptr pong;
+    uint64_t rounds = 0;
+    uint64_t start = 0;
+    coServer::Histogram latency;
+    std::atomic<bool> done {false};
+};
+
+static void bench(size_t background_count, uint64_t rounds, uint32_t limit){
+    coServer::Config::Lookup<uint32_t>("scheduler.run_next_limit")->setValue(limit);
+    s_running = true;
+    s_background_done = 0;
+
+    coServer::Scheduler sc(1, false, "run_next");
+    sc.start();
+    for(size_t i = 0; i < background_count; ++i){
+        sc.schedule(&background);
+    }
+
+    std::shared_ptr<PingPong> pp(new PingPong);
+    pp->rounds = rounds;
+    // 唤醒对方后挂起自己；只有一个工作线程，对方在自己切出后才会执行
+    pp->pong.reset(new coServer::Fiber([pp](){
+        for(uint64_t n = 0; n < pp->rounds; ++n){
+            coServer::Fiber::YieldToHold();
+            coServer::Scheduler::GetThis()->schedule(pp->ping);
+        }
+    }));
+    pp->ping.reset(new coServer::Fiber([pp](){
+        for(uint64_t n = 0; n < pp->rounds; ++n){
+            pp->start = coServer::GetCurrentUS();
+            coServer::Scheduler::GetThis()->schedule(pp->pong);
+            coServer::Fiber::YieldToHold();
+            pp->latency.record(coServer::GetCurrentUS() - pp->start);
+        }
+        pp->done = true;
+    }));
+    // pong 先挂起，再启动 ping
+    sc.schedule(pp->pong);
+    usleep(10 * 1000);
+    uint64_t begin = coServer::GetCurrentUS();
+    uint64_t background_begin = s_background_done;
+    sc.schedule(pp->ping);
+    while(!pp->done){
+        usleep(1000);
+    }
+    uint64_t used = coServer::GetCurrentUS() - begin;
+    uint64_t background_done = s_background_done - background_begin;
+    s_running = false;
+    sc.stop();
+
+    std::cout << (limit ? "on " : "off")
+        << " rtt p50=" << pp->latency.percentile(0.5) << "us"
+        << " p99=" << pp->latency.percentile(0.99) << "us"
+        << " max=" << pp->latency.getMax() << "us"
+        << " elapsed=" << used / 1000 << "ms"
+        << " background=" << background_done * 1000000.0 / used << " tasks/s"
+        << std::endl;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    size_t background_count = argc > 1 ? atoi(argv[1]) : 64;
+    uint64_t rounds = argc > 2 ? atoll(argv[2]) : 500;
+    std::cout << "background=" << background_count << " rounds=" << rounds << std::endl;
+    bench(background_count, rounds, 0);
+    bench(background_count, rounds, 8);
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <atomic>
+#include <iostream>
+
+#include "src/log.h"
+#include "src/scheduler.h"
+#include "src/util.h"
+
+/**
+ *  调度器吞吐随线程数的变化
+ *  用法：test_scheduler_scale [最大线程数=8] [任务数=200000]
+ *  inject : 所有任务由外部线程提交（全局队列）
+ *  spawn  : 少量根任务在调度线程内继续提交子任务（本地队列 + 窃取）
+*/
+
+static std::atomic<uint64_t> s_done {0};
+
+static void work(){
+    // 模拟少量计算
+    volatile uint64_t x = 0;
+    for(int i = 0; i < 200; ++i){
+        x += i;
+    }
+    ++s_done;
+}
+
+static double bench_inject(size_t threads, uint64_t tasks){
+    s_done = 0;
+    coServer::Scheduler sc(threads, false, "inject");
+    sc.start();
+    uint64_t begin = coServer::GetCurrentUS();
+    for(uint64_t i = 0; i < tasks; ++i){
+        sc.schedule(&work);
+    }
+    sc.stop();
+    uint64_t used = coServer::GetCurrentUS() - begin;
+    return tasks * 1000000.0 / used;
+}
+
+static double bench_spawn(size_t threads, uint64_t tasks){
+    s_done = 0;
+    const uint64_t roots = 64;
+    coServer::Scheduler sc(threads, false, "spawn");
+    sc.start();
+    uint64_t begin = coServer::GetCurrentUS();
+    for(uint64_t i = 0; i < roots; ++i){
+        sc.schedule([tasks, roots](){
+            coServer::Scheduler* s = coServer::Scheduler::GetThis();
+            for(uint64_t j = 0; j < tasks / roots; ++j){
+                s->schedule(&work);
+            }
+        });
+    }
+    sc.stop();
+    uint64_t used = coServer::GetCurrentUS() - begin;
+    return tasks * 1000000.0 / used;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    size_t max_threads = argc > 1 ? atoi(argv[1]) : 8;
+    uint64_t tasks = argc > 2 ? atoll(argv[2]) : 200000;
+    for(size_t t = 1; t <= max_threads; t *= 2){
+        double inject = bench_inject(t, tasks);
+        double spawn = bench_spawn(t, tasks);
+        std::cout << "threads=" << t
+            << " inject=" << (uint64_t)inject << " tasks/s"
+            << " spawn=" << (uint64_t)spawn << " tasks/s" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+
+#include "src/config.h"
+#include "src/fiber.h"
+#include "src/log.h"
+#include "src/scheduler.h"
+#include "src/util.h"
+
+/**
+ *  调度统计的开销与快照输出
+ *  用法：test_scheduler_stats [线程数=4] [协程数=64] [每个协程的切换次数=20000]
+ *  off / on : 关闭 / 开启 scheduler.stats 时每次 YieldToReady 的开销（交替测 3 次取最小值）
+ *  之后运行一批耗时不同的任务并输出 getStats 快照
+*/
+
+static std::atomic<uint64_t> s_done {0};
+
+static double bench_yield(size_t threads, size_t fibers, uint64_t rounds){
+    uint64_t begin = coServer::GetCurrentUS();
+    {
+        coServer::Scheduler sc(threads, false, "yield");
+        for(size_t i = 0; i < fibers; ++i){
+            sc.schedule([rounds](){
+                for(uint64_t j = 0; j < rounds; ++j){
+                    coServer::Fiber::YieldToReady();
+                }
+            });
+        }
+        sc.start();
+        sc.stop();
+    }
+    uint64_t used = coServer::GetCurrentUS() - begin;
+    return used * 1000.0 / (fibers * rounds);
+}
+
+static void spin_us(uint64_t us){
+    uint64_t end = coServer::GetCurrentUS() + us;
+    while(coServer::GetCurrentUS() < end);
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    size_t threads = argc > 1 ? atoi(argv[1]) : 4;
+    size_t fibers = argc > 2 ? atoi(argv[2]) : 64;
+    uint64_t rounds = argc > 3 ? atoll(argv[3]) : 20000;
+
+    coServer::ConfigVar<bool>::ptr stats = coServer::Config::Lookup<bool>("scheduler.stats", false);
+    double off = 1e18, on = 1e18;
+    for(int i = 0; i < 3; ++i){
+        stats->setValue(false);
+        off = std::min(off, bench_yield(threads, fibers, rounds));
+        stats->setValue(true);
+        on = std::min(on, bench_yield(threads, fibers, rounds));
+    }
+    std::cout << "threads=" << threads << " fibers=" << fibers << " rounds=" << rounds << std::endl
+        << "stats off: " << off << " ns/yield" << std::endl
+        << "stats on:  " << on << " ns/yield (" << (on - off) * 100 / off << "%)" << std::endl;
+
+    coServer::Scheduler sc(threads, false, "stats");
+    sc.start();
+    for(int i = 0; i < 2000; ++i){
+        sc.schedule([i](){
+            spin_us(i % 10 == 0 ? 200 : 5);
+            coServer::Fiber::YieldToReady();
+            ++s_done;
+        });
+        if(i % 100 == 0){
+            usleep(1000);
+        }
+    }
+    while(s_done < 2000){
+        usleep(1000);
+    }
+    coServer::Scheduler::Stats snapshot;
+    sc.getStats(snapshot);
+    snapshot.dump(std::cout);
+    sc.stop();
+    return 0;
+}
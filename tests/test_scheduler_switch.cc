@@ -0,0 +1,109 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <iostream>
+#include <memory>
+
+#include "src/iomanager.h"
+#include "src/log.h"
+#include "src/scheduler.h"
+#include "src/util.h"
+
+/**
+ *  协程在调度器之间切换
+ *  用法：test_scheduler_switch [协程数=16] [每个协程的往返次数=2000]
+ *  网络 IOManager 上的协程用 SchedulerSwitcher 切到计算调度器执行一段计算再切回来：
+ *  switch   : SchedulerSwitcher 往返（同一个协程，两次切换）
+ *  callback : 旧写法，向计算调度器提交新的回调，完成后再把原协程调度回网络调度器
+ *  同时检查计算部分确实运行在计算调度器上，切回后运行在网络调度器上
+*/
+
+static std::atomic<uint64_t> s_done {0};
+static std::atomic<uint64_t> s_bad {0};
+
+static void compute(){
+    volatile uint64_t x = 0;
+    for(int i = 0; i < 200; ++i){
+        x += i;
+    }
+}
+
+static void bench(bool use_switch, size_t fibers, size_t rounds){
+    s_done = 0;
+    s_bad = 0;
+    coServer::Scheduler cpu(2, false, "cpu");
+    cpu.start();
+    uint64_t begin = coServer::GetCurrentUS();
+    {
+        coServer::IOManager net(2, false, "net");
+        for(size_t i = 0; i < fibers; ++i){
+            net.schedule([&cpu, &net, use_switch, rounds](){
+                for(size_t j = 0; j < rounds; ++j){
+                    if(use_switch){
+                        coServer::SchedulerSwitcher sw(&cpu);
+                        if(coServer::Scheduler::GetThis() != &cpu){
+                            ++s_bad;
+                        }
+                        compute();
+                    }
+                    else{
+                        coServer::Fiber::ptr self = coServer::Fiber::GetThis();
+                        cpu.schedule([self, &net](){
+                            if(coServer::Scheduler::GetThis() != &net){
+                                compute();
+                            }
+                            else{
+                                ++s_bad;
+                            }
+                            net.schedule(self);
+                        });
+                        coServer::Fiber::YieldToHold();
+                    }
+                    if(coServer::Scheduler::GetThis() != &net){
+                        ++s_bad;
+                    }
+                }
+                ++s_done;
+            });
+        }
+        while(s_done < fibers){
+            usleep(1000);
+        }
+    }
+    uint64_t used = coServer::GetCurrentUS() - begin;
+    cpu.stop();
+    std::cout << (use_switch ? "switch  " : "callback")
+        << " fibers=" << fibers << " rounds=" << rounds
+        << " " << used * 1000.0 / (fibers * rounds) << " ns/round-trip"
+        << " bad=" << s_bad << std::endl;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    size_t fibers = argc > 1 ? atoi(argv[1]) : 16;
+    size_t rounds = argc > 2 ? atoi(argv[2]) : 2000;
+    bench(false, fibers, rounds);
+    bench(true, fibers, rounds);
+
+    // 切到指定线程
+    coServer::Scheduler cpu(2, false, "pin");
+    cpu.start();
+    std::atomic<int> target {-1};
+    std::atomic<bool> ok {false};
+    cpu.schedule([&target](){
+        target = coServer::GetThreadId();
+    });
+    while(target == -1){
+        usleep(1000);
+    }
+    {
+        coServer::IOManager net(1, false, "net");
+        net.schedule([&cpu, &target, &ok](){
+            cpu.switchTo(target);
+            ok = coServer::GetThreadId() == target;
+        });
+    }
+    cpu.stop();
+    std::cout << "switchTo(thread) " << (ok ? "ok" : "WRONG") << std::endl;
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <string>
+
+#include "src/fiber.h"
+#include "src/fiber_context.h"
+#include "src/log.h"
+
+/**
+ *  共享栈协程的正确性测试
+ *  多个共享栈协程交替运行，每个协程递归 DEPTH 层，每层在栈上放一块与协程和层数相关的数据并切出，
+ *  切回后检查数据没有被其他协程改写；栈上内容按切出时保存的栈顶拷贝，
+ *  保存的大小不小于实际使用的深度，也不会是整个共享栈
+ *  ucontext 实现用 cmake -DCOSERVER_FIBER_UCONTEXT=ON 编译后运行
+*/
+
+static const int FIBERS = 8;
+static const int DEPTH = 16;
+static const size_t FRAME = 512;
+
+static int s_bad = 0;
+static size_t s_max_saved = 0;
+
+static void check(bool ok, const std::string& what){
+    if(!ok){
+        ++s_bad;
+        std::cout << "FAILED: " << what << std::endl;
+    }
+}
+
+static bool verify(const volatile unsigned char* buf, unsigned char v){
+    for(size_t i = 0; i < FRAME; ++i){
+        if(buf[i] != v){
+            return false;
+        }
+    }
+    return true;
+}
+
+// 每层切出两次：放好数据后，以及更深的层返回后
+static bool recurse(int id, int level){
+    volatile unsigned char buf[FRAME];
+    unsigned char v = (unsigned char)(id * 31 + level + 1);
+    for(size_t i = 0; i < FRAME; ++i){
+        buf[i] = v;
+    }
+    coServer::Fiber::GetThisRaw()->back();
+    bool ok = verify(buf, v);
+    if(level + 1 < DEPTH){
+        ok = recurse(id, level + 1) && ok;
+    }
+    coServer::Fiber::GetThisRaw()->back();
+    return verify(buf, v) && ok;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    coServer::Fiber::GetThis();
+    bool results[FIBERS] = {false};
+    coServer::Fiber::ptr fibers[FIBERS];
+    for(int i = 0; i < FIBERS; ++i){
+        bool* out = &results[i];
+        fibers[i].reset(new coServer::Fiber([i, out](){
+            *out = recurse(i, 0);
+        }, 0, true, true));
+    }
+
+    size_t switches = 0;
+    bool running = true;
+    while(running){
+        running = false;
+        for(auto& i : fibers){
+            if(i->getState() == coServer::Fiber::TERM){
+                continue;
+            }
+            i->call();
+            ++switches;
+            running = true;
+        }
+        // 其他协程切入后上一个占用共享栈的协程已经保存
+        for(auto& i : fibers){
+            if(i->getSavedStackSize() > s_max_saved){
+                s_max_saved = i->getSavedStackSize();
+            }
+        }
+    }
+
+    for(int i = 0; i < FIBERS; ++i){
+        check(results[i], "fiber " + std::to_string(i) + " stack data corrupted");
+    }
+    check(switches == (size_t)FIBERS * (DEPTH * 2 + 1), "switches " + std::to_string(switches));
+    check(s_max_saved >= DEPTH * FRAME, "saved stack smaller than used " + std::to_string(s_max_saved));
+    check(s_max_saved < fibers[0]->getStackSize(), "saved the whole shared stack");
+    std::cout << "context=" << coServer::FiberContextImpl()
+        << " switches=" << switches
+        << " max_saved=" << s_max_saved << "B"
+        << " stack=" << fibers[0]->getStackSize() << "B" << std::endl;
+    std::cout << (s_bad ? "FAILED" : "OK") << std::endl;
+    return s_bad ? 1 : 0;
+}
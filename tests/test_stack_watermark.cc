@@ -0,0 +1,96 @@
+#include <string.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "src/config.h"
+#include "src/fiber.h"
+#include "src/log.h"
+#include "src/scheduler.h"
+
+/**
+ *  协程栈水位（fiber.stack_watermark）的测试
+ *  on  : 协程在栈上使用 DEPTH 字节，getStackUsage 不小于 DEPTH；
+ *        同一个协程复用后执行浅的任务，水位按重新填充后的实际深度计算；
+ *        dumpStackUsage 输出的最大值不小于 DEPTH
+ *  off : 不开启时 getStackUsage 为 0，调度器不记录
+*/
+
+static const size_t DEPTH = 32 * 1024;
+static const int DEEP_TASKS = 4;
+static int s_bad = 0;
+
+static void check(bool ok, const std::string& what){
+    if(!ok){
+        ++s_bad;
+        std::cout << "FAILED: " << what << std::endl;
+    }
+}
+
+// 在栈上写满 DEPTH 字节，返回此时的水位
+static size_t deep(){
+    volatile char buf[DEPTH];
+    memset((char*)buf, 1, sizeof(buf));
+    return coServer::Fiber::GetThis()->getStackUsage();
+}
+
+static size_t shallow(){
+    return coServer::Fiber::GetThis()->getStackUsage();
+}
+
+static uint64_t dump_value(const std::string& dump, const std::string& key){
+    size_t pos = dump.find(" " + key + "=");
+    if(pos == std::string::npos){
+        return 0;
+    }
+    return strtoull(dump.c_str() + pos + key.size() + 2, nullptr, 10);
+}
+
+static void test_watermark(bool on){
+    coServer::Config::Lookup<bool>("fiber.stack_watermark")->setValue(on);
+    size_t deep_usage[DEEP_TASKS] = {0};
+    size_t shallow_usage = ~(size_t)0;
+    std::ostringstream ss;
+    {
+        coServer::Scheduler sc(1, false, on ? "watermark_on" : "watermark_off");
+        // 单线程按顺序执行，后面的任务复用前面结束的协程
+        for(int i = 0; i < DEEP_TASKS; ++i){
+            size_t* out = &deep_usage[i];
+            sc.schedule([out](){ *out = deep(); });
+        }
+        sc.schedule([&shallow_usage](){ shallow_usage = shallow(); });
+        sc.start();
+        sc.stop();
+        sc.dumpStackUsage(ss);
+    }
+    std::string dump = ss.str();
+    uint64_t count = dump_value(dump, "count");
+    uint64_t max = dump_value(dump, "max");
+    std::cout << dump;
+
+    if(on){
+        for(int i = 0; i < DEEP_TASKS; ++i){
+            check(deep_usage[i] >= DEPTH, "deep usage " + std::to_string(deep_usage[i]));
+        }
+        check(shallow_usage < DEPTH, "shallow usage after reuse " + std::to_string(shallow_usage));
+        check(count == DEEP_TASKS + 1, "dump count " + std::to_string(count));
+        check(max >= DEPTH, "dump max " + std::to_string(max));
+    }
+    else{
+        for(int i = 0; i < DEEP_TASKS; ++i){
+            check(deep_usage[i] == 0, "deep usage without watermark");
+        }
+        check(shallow_usage == 0, "shallow usage without watermark");
+        check(count == 0, "dump count without watermark");
+    }
+    std::cout << (on ? "on " : "off") << " deep=" << deep_usage[0]
+        << " shallow=" << shallow_usage << std::endl;
+}
+
+int main(int argc, char** argv){
+    COSERVER_LOG_NAME("system")->setLevel(coServer::LogLevel::ERROR);
+    test_watermark(true);
+    test_watermark(false);
+    std::cout << (s_bad ? "FAILED" : "OK") << std::endl;
+    return s_bad ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "src/log.h"
+#include "src/timer.h"
+
+/**
+ *  条件定时器的测试，直接调用 listExpiredCb 触发，不依赖 IOManager
+ *  recurring : 循环条件定时器每次触发拷贝一份回调，条件对象释放后不再执行
+ *  move only : 只能移动的回调作为单次条件定时器正常执行；作为循环条件定时器在添加时断言失败
+*/
+
+static int s_bad = 0;
+
+class TestTimerManager : public coServer::TimerManager{
+protected:
+    void onTimerInsertedAtFront() override {}
+};
+
+static void check(bool ok, const char* what){
+    if(!ok){
+        ++s_bad;
+        std::cout << "FAILED: " << what << std::endl;
+    }
+}
+
+// 等待 ms 毫秒后执行到期的回调，返回执行的个数
+static size_t fire(TestTimerManager& mgr, uint64_t ms){
+    usleep(ms * 1000);
+    std::vector<coServer::SmallCallable> cbs;
+    mgr.listExpiredCb(cbs);
+    for(auto& cb : cbs){
+        cb();
+    }
+    return cbs.size();
+}
+
+static void test_recurring(){
+    TestTimerManager mgr;
+    std::shared_ptr<int> cond(new int(0));
+    std::shared_ptr<int> count(new int(0));
+    coServer::Timer::ptr timer = mgr.addConditionTimer(5, [count](){
+        ++*count;
+    }, cond, true);
+    for(int i = 0; i < 3; ++i){
+        check(fire(mgr, 10) == 1, "recurring not fired");
+    }
+    check(*count == 3, "recurring count");
+    check(mgr.hasTimer(), "recurring timer removed");
+
+    // 条件对象释放后仍然触发，但不执行回调
+    cond.reset();
+    fire(mgr, 10);
+    check(*count == 3, "recurring ran after condition released");
+    timer->cancel();
+    check(!mgr.hasTimer(), "recurring not cancelled");
+    std::cout << "recurring count=" << *count << std::endl;
+}
+
+static void test_move_only(){
+    TestTimerManager mgr;
+    std::shared_ptr<int> cond(new int(0));
+    std::unique_ptr<int> value(new int(42));
+    int got = 0;
+    int* out = &got;
+    // C++11 没有初始化捕获，用 std::bind 把 unique_ptr 移进回调
+    mgr.addConditionTimer(5, std::bind([out](std::unique_ptr<int>& v){
+        *out = *v;
+    }, std::move(value)), cond);
+    check(fire(mgr, 10) == 1 && got == 42, "move only one-shot");
+
+    // 循环条件定时器的回调只能移动时在添加时断言失败，而不是第一次触发时访问空回调
+    pid_t pid = fork();
+    if(pid == 0){
+        COSERVER_LOG_ROOT()->setLevel(coServer::LogLevel::FATAL);
+        std::unique_ptr<int> v(new int(1));
+        mgr.addConditionTimer(5, std::bind([](std::unique_ptr<int>&){}, std::move(v)), cond, true);
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    check(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT, "move only recurring not rejected");
+    std::cout << "move only got=" << got << " recurring "
+        << (WIFSIGNALED(status) ? "rejected" : "accepted") << std::endl;
+}
+
+int main(int argc, char** argv){
+    test_recurring();
+    test_move_only();
+    std::cout << (s_bad ? "FAILED" : "OK") << std::endl;
+    return s_bad ? 1 : 0;
+}